@@ -10,7 +10,61 @@
 #define MEMORY_BUFFER_H_
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h> /*NULL (stddef)*/
+#include <sys/types.h> /*ssize_t*/
+
+/* A size-classed buffer pool, see mem_pool_create.  */
+typedef struct mem_pool mem_pool_t;
+
+/**
+ * Counters of a mem_pool, merged from every thread cache
+ */
+typedef struct mem_pool_stats {
+  uint64_t hits;     // allocations served by a thread cache or free list
+  uint64_t misses;   // allocations that needed new memory from the system
+  uint64_t frees;    // buffers given back to the pool
+  uint64_t oversize; // allocations above the largest class (not pooled)
+} mem_pool_stats_t;
+
+/**
+ * @brief Creates a pool of buffers in power of two classes from 4 KiB to
+ * 64 MiB. Each thread keeps a small cache per class, so a steady state of
+ * allocations and releases of similar sizes does not reach the system
+ * allocator nor contends on a lock.
+ *
+ * @param hugepages back the pool with transparent huge pages when possible
+ * @return mem_pool_t* pool, NULL on failure
+ */
+mem_pool_t *mem_pool_create(bool hugepages);
+
+/**
+ * @brief Allocates a buffer of at least length bytes.
+ *
+ * @param pool to allocate from, NULL uses malloc
+ * @param length amount of bytes
+ * @return void* buffer to release with mem_pool_free, NULL on failure
+ */
+void *mem_pool_alloc(mem_pool_t *pool, size_t length);
+
+/**
+ * @brief Gives a buffer back to the pool it was allocated from.
+ *
+ * @param pool the buffer comes from, NULL uses free
+ * @param buffer from mem_pool_alloc (or from one of the *_pool readers)
+ */
+void mem_pool_free(mem_pool_t *pool, void *buffer);
+
+/**
+ * @brief Reads the counters of pool.
+ */
+void mem_pool_get_stats(mem_pool_t *pool, mem_pool_stats_t *stats);
+
+/**
+ * @brief Releases every buffer of pool back to the system. No thread may use
+ * the pool (or its buffers) afterwards.
+ */
+void mem_pool_destroy(mem_pool_t *pool);
 
 /* A handle for a temporary file the underlying type is a file descriptor.  */
 typedef int tmp_file_handle;
@@ -23,11 +77,33 @@ typedef int tmp_file_handle;
  * @return tmp_file_handle handle to the temporary file. Which is already
  * unlinked
  */
-tmp_file_handle write_tmp_mem_buf(char *buffer, size_t length);
+tmp_file_handle write_tmp_mem_buff(char *buffer, size_t length);
+
+/**
+ * The encodings a spilled buffer can be stored with
+ */
+typedef enum mem_codec {
+  MEM_CODEC_NONE = 0, // raw data, the original length-prefixed record
+  MEM_CODEC_LZ   = 1, // in-tree LZ77 codec (LZ4 block layout)
+} mem_codec_t;
+
+/**
+ * @brief Same as write_tmp_mem_buff encoding the buffer with codec. A
+ * compressed record carries the compressed and uncompressed sizes plus a
+ * CRC-32 of the data. Buffers that don't shrink are stored raw.
+ *
+ * @param buffer into a temporary file
+ * @param length amount of bytes and
+ * @param codec to encode the buffer with
+ * @return tmp_file_handle handle to the temporary file, -1 on failure
+ */
+tmp_file_handle write_tmp_mem_buff_codec(char *buffer, size_t length,
+                                         mem_codec_t codec);
 
 /**
  * @brief Reads the contents of a temporary file TMP_FILE. The
- *  temporary file is removed after close.
+ *  temporary file is removed after close. Compressed records are
+ *  decompressed and their checksum verified.
  *
  * @param tmp_file handle for the unique created file
  * @param length to retrieve amount of bytes stored on the mem buffer
@@ -35,6 +111,49 @@ tmp_file_handle write_tmp_mem_buf(char *buffer, size_t length);
  */
 char *read_tmp_mem_buff(tmp_file_handle tmp_file, size_t *length);
 
+/**
+ * @brief Same as read_tmp_mem_buff with the buffer allocated from pool.
+ *
+ * @param pool to allocate from, NULL uses malloc
+ * @return char* buffer to release with mem_pool_free(pool, ...), NULL when
+ * the file is truncated or can't be read
+ */
+char *read_tmp_mem_buff_pool(tmp_file_handle tmp_file, size_t *length,
+                             mem_pool_t *pool);
+
+/* A buffer and its length, the element of the batched APIs.  */
+typedef struct mem_buff {
+  char *buffer;
+  size_t length;
+} mem_buff_t;
+
+/**
+ * @brief Writes count buffers into a unique temporary file with a single
+ * vectored write, each one with the same layout as write_tmp_mem_buff
+ * (length followed by the data). Partial writes are resumed.
+ *
+ * @param bufs buffers to write, in order
+ * @param count amount of buffers in bufs
+ * @return tmp_file_handle handle to the unlinked temporary file, -1 on
+ * failure
+ */
+tmp_file_handle write_tmp_mem_batch(const mem_buff_t *bufs, size_t count);
+
+/**
+ * @brief Reads back up to count buffers written by write_tmp_mem_batch (or
+ * write_tmp_mem_buff) using one preadv per buffer, which fetches its data
+ * together with the length of the next one. The temporary file is removed
+ * after close. Compressed records (write_tmp_mem_buff_codec) are decompressed
+ * and their checksum verified, like read_tmp_mem_buff does.
+ *
+ * @param tmp_file handle for the unique created file
+ * @param bufs filled with allocated buffers (must be free) and lengths
+ * @param count room in bufs
+ * @return size_t amount of buffers read
+ */
+size_t read_tmp_mem_batch(tmp_file_handle tmp_file, mem_buff_t *bufs,
+                          size_t count);
+
 /**
  * @brief Returns a buffer of length allocated to read from filename.
  *
@@ -44,4 +163,308 @@ char *read_tmp_mem_buff(tmp_file_handle tmp_file, size_t *length);
  */
 char *read_from_file(const char *filename, const size_t length, const bool block);
 
+/**
+ * @brief Same as read_from_file with the buffer allocated from pool.
+ *
+ * @param pool to allocate from, NULL uses malloc
+ * @return char* buffer to release with mem_pool_free(pool, ...)
+ */
+char *read_from_file_pool(const char *filename, const size_t length,
+                          const bool block, mem_pool_t *pool);
+
+/**
+ * Throughput of a transfer
+ */
+typedef struct mem_io_stats {
+  size_t bytes;        // bytes transferred
+  uint64_t elapsed_ns; // wall time of the transfer
+  double mb_per_s;     // bytes / elapsed in MB/s (10^6 bytes)
+  bool direct;         // false when the page cache had to be used
+} mem_io_stats_t;
+
+/**
+ * @brief Reads filename with O_DIRECT, bypassing the page cache so a bulk
+ * load doesn't evict the cached working set. The buffer is aligned to the
+ * direct I/O block and the unaligned tail is handled. Filesystems without
+ * O_DIRECT (tmpfs) are read through the cache, which is then dropped with
+ * POSIX_FADV_DONTNEED.
+ *
+ * @param filename path to read
+ * @param length amount of bytes to read, 0 (or more than the file) reads
+ * the whole file
+ * @param read_length to retrieve amount of bytes read
+ * @param stats to retrieve the throughput, may be NULL
+ * @return char* is an aligned allocated buffer. Must be free. NULL on error
+ */
+char *read_from_file_direct(const char *filename, size_t length,
+                            size_t *read_length, mem_io_stats_t *stats);
+
+/**
+ * The outcome of loading one file with load_files_parallel
+ */
+typedef struct mem_load_result {
+  char *buffer;        // allocated from the pool, NULL on error
+  size_t length;       // bytes in buffer
+  int error;           // 0 on success, errno of the failure otherwise
+                       // (ENODATA: the file is shorter than the length
+                       // asked for)
+  uint64_t elapsed_ns; // time spent opening and reading the file
+} mem_load_result_t;
+
+/**
+ * @brief Loads count files fanning the reads out across a bounded pool of
+ * worker threads (the caller is one of them), so the total time follows the
+ * I/O parallelism instead of the amount of files. Short reads and EINTR are
+ * retried.
+ *
+ * @param paths files to load
+ * @param lengths bytes to read per file, NULL (or a 0 entry) reads the
+ * whole file
+ * @param count amount of paths
+ * @param workers threads to use, 0 picks twice the online CPUs (4 to 64)
+ * @param pool to allocate the buffers from, NULL uses malloc
+ * @param results count entries filled in the same order as paths
+ * @return size_t amount of files loaded successfully
+ */
+size_t load_files_parallel(const char *const *paths, const size_t *lengths,
+                           size_t count, unsigned int workers,
+                           mem_pool_t *pool, mem_load_result_t *results);
+
+/* A read-only view of a file's contents. Mapped when the file is a regular
+   file, otherwise backed by a buffer obtained through read_from_file.  */
+typedef struct mem_buff_view {
+  const char *data;  /* first byte of the contents (NULL when empty) */
+  size_t length;     /* amount of bytes available on data */
+  size_t map_length; /* bytes mapped, 0 when data is an allocated buffer */
+} mem_buff_view_t;
+
+/**
+ * @brief Maps filename read-only into memory without copying it. Regular
+ * files are mapped with sequential/willneed hints; pipes, FIFOs and other
+ * non seekable files fall back to read_from_file.
+ *
+ * @param filename path to map
+ * @param length amount of bytes to map, 0 maps the whole (regular) file
+ * @param block open mode used for the read_from_file fallback
+ * @param view filled with the mapped contents on success
+ * @return true if view is valid. Must be released with release_mapped_file.
+ */
+bool map_from_file(const char *filename, const size_t length, const bool block,
+                   mem_buff_view_t *view);
+
+/**
+ * @brief Unmaps (or frees) the contents referenced by view.
+ *
+ * @param view previously filled by map_from_file
+ */
+void release_mapped_file(mem_buff_view_t *view);
+
+/**
+ * Receives each chunk delivered by the streaming reader. The chunk is only
+ * valid during the call. Returning false stops the stream.
+ */
+typedef bool (*mem_chunk_callback)(const char *chunk, size_t length,
+                                   void *ctx);
+
+/**
+ * @brief Streams the contents of fd in chunks of chunk_size bytes through a
+ * ring of nbufs caller-supplied buffers. A reader thread keeps filling the
+ * free buffers while callback consumes the filled ones on the calling
+ * thread. Short reads, EINTR and EAGAIN are retried, only the last chunk can
+ * be shorter than chunk_size.
+ *
+ * @param fd opened for reading, it is not closed
+ * @param ring nbufs buffers of at least chunk_size bytes each
+ * @param nbufs amount of buffers in ring, 1 reads and consumes in turns
+ * @param chunk_size bytes per chunk
+ * @param callback invoked in order for every chunk
+ * @param ctx passed to callback
+ * @return ssize_t total bytes delivered to callback, -1 on a read error
+ */
+ssize_t stream_from_fd(int fd, char **ring, size_t nbufs, size_t chunk_size,
+                       mem_chunk_callback callback, void *ctx);
+
+/**
+ * @brief Opens filename read-only and streams it with stream_from_fd. A FIFO
+ * is streamed until its last writer closes it.
+ *
+ * @return ssize_t total bytes delivered to callback, -1 on error
+ */
+ssize_t stream_from_file(const char *filename, char **ring, size_t nbufs,
+                         size_t chunk_size, mem_chunk_callback callback,
+                         void *ctx);
+
+/* A handle for a record in a spill store, its offset in the backing file.  */
+typedef off_t spill_handle;
+
+/**
+ * A store keeping many spilled buffers as length-prefixed records appended
+ * on a single unlinked backing file, so spilling a buffer costs one write
+ * instead of creating a new temporary file. Several threads can spill into
+ * the same store.
+ */
+typedef struct spill_store spill_store_t;
+
+/**
+ * @brief Creates a spill store and its backing file. The file is anonymous
+ * (O_TMPFILE or unlinked right after mkstemp) and goes away when the store
+ * is closed.
+ *
+ * @param dir where the backing file lives, NULL for /tmp
+ * @return spill_store_t* store, NULL on failure
+ */
+spill_store_t *spill_store_open(const char *dir);
+
+/**
+ * @brief Appends buffer to the store as a length-prefixed record.
+ *
+ * @param store opened with spill_store_open
+ * @param buffer to spill
+ * @param length amount of bytes of buffer
+ * @return spill_handle to read the record back, -1 on failure
+ */
+spill_handle spill_store_write(spill_store_t *store, const char *buffer,
+                               size_t length);
+
+/**
+ * @brief Appends count buffers as consecutive records with a single
+ * vectored write.
+ *
+ * @param store opened with spill_store_open
+ * @param bufs buffers to spill
+ * @param count amount of buffers in bufs
+ * @param handles filled with the handle of every record
+ * @return true on success
+ */
+bool spill_store_write_batch(spill_store_t *store, const mem_buff_t *bufs,
+                             size_t count, spill_handle *handles);
+
+/**
+ * @brief Reads back the record referenced by handle. Records can be read
+ * any amount of times and in any order.
+ *
+ * @param store opened with spill_store_open
+ * @param handle returned by spill_store_write
+ * @param length to retrieve amount of bytes of the record
+ * @return char* is a allocated buffer. Must be free. NULL on failure
+ */
+char *spill_store_read(spill_store_t *store, spill_handle handle,
+                       size_t *length);
+
+/**
+ * @brief Drops every record, handles previously returned become invalid.
+ * The backing file is truncated and reused.
+ *
+ * @param store opened with spill_store_open
+ * @return true on success
+ */
+bool spill_store_reset(spill_store_t *store);
+
+/**
+ * @brief Closes the backing file, its records go away with it, and releases
+ * the store.
+ *
+ * @param store opened with spill_store_open, can be NULL
+ */
+void spill_store_close(spill_store_t *store);
+
+/**
+ * The operations a mem_aio context can keep in flight
+ */
+typedef enum mem_aio_op {
+  MEM_AIO_READ_FILE = 0, // read length bytes of a file (read_from_file)
+  MEM_AIO_SPILL     = 1, // append a record to a spill store
+  MEM_AIO_RELOAD    = 2, // read a record back from a spill store
+} mem_aio_op_t;
+
+/**
+ * The completion of an operation submitted to a mem_aio context
+ */
+typedef struct mem_aio_result {
+  mem_aio_op_t op;
+  /**
+   * The pointer given when the operation was submitted
+   */
+  void *user_data;
+  /**
+   * 0 on success, the errno of the failure otherwise (ENODATA for a file or
+   * record shorter than expected)
+   */
+  int error;
+  /**
+   * READ_FILE and RELOAD: allocated buffer, must be free. NULL on error
+   */
+  char *buffer;
+  size_t length;
+  /**
+   * SPILL: handle of the new record
+   */
+  spill_handle handle;
+} mem_aio_result_t;
+
+/* An asynchronous I/O context, io_uring backed when the kernel allows it */
+typedef struct mem_aio mem_aio_t;
+
+/**
+ * @brief Creates a context able to keep depth operations in flight. When
+ * io_uring is unavailable (old kernel, seccomp, not compiled in) the context
+ * falls back to the synchronous path: operations complete on submission and
+ * are returned by the next reap.
+ *
+ * @param depth maximum amount of operations not yet reaped
+ * @return mem_aio_t* context, NULL on failure
+ */
+mem_aio_t *mem_aio_create(unsigned int depth);
+
+/**
+ * @brief Tells whether the context runs on io_uring or on the fallback.
+ */
+bool mem_aio_is_async(const mem_aio_t *aio);
+
+/**
+ * @brief Queues the read of length bytes of filename into a new buffer.
+ *
+ * @return true if queued, false when depth operations are pending or the
+ * file can't be opened
+ */
+bool mem_aio_read_file(mem_aio_t *aio, const char *filename, size_t length,
+                       void *user_data);
+
+/**
+ * @brief Queues the append of buffer to store. buffer must stay valid until
+ * the operation is reaped.
+ *
+ * @return true if queued
+ */
+bool mem_aio_spill(mem_aio_t *aio, spill_store_t *store, const char *buffer,
+                   size_t length, void *user_data);
+
+/**
+ * @brief Queues the read of the record referenced by handle from store.
+ *
+ * @return true if queued
+ */
+bool mem_aio_reload(mem_aio_t *aio, spill_store_t *store, spill_handle handle,
+                    void *user_data);
+
+/**
+ * @brief Submits the queued operations and reaps the completed ones. When
+ * the ring fails, the operations not submitted yet complete with its error
+ * and the reap returns without waiting for min_wait.
+ *
+ * @param aio context
+ * @param results filled with up to max completions
+ * @param max room in results
+ * @param min_wait completions to wait for (bounded by the pending ones)
+ * @return size_t amount of results filled
+ */
+size_t mem_aio_reap(mem_aio_t *aio, mem_aio_result_t *results, size_t max,
+                    size_t min_wait);
+
+/**
+ * @brief Waits for every pending operation and releases the context.
+ * Buffers of operations never reaped are freed.
+ */
+void mem_aio_destroy(mem_aio_t *aio);
+
 #endif // MEMORY_BUFFER_H_
\ No newline at end of file
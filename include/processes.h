@@ -9,13 +9,265 @@
 #ifndef processes_H_
 #define processes_H_
 
+#include <spawn.h> /*posix_spawn_file_actions_t, posix_spawnattr_t*/
+#include <stdbool.h>
+#include <stddef.h> /*size_t*/
+#include <stdint.h>
+#include <sys/resource.h> /*struct rusage*/
+#include <sys/types.h> /*pid_t*/
+
 /**
- * @brief Creates a new program. arg_list must be a null termanted list
+ * @brief Creates a new program and waits for it. arg_list must be a null
+ * termanted list
  * 
  * @param program to be executed from the path
  * @param arg_list 
- * @return int the proced ID of the child created
+ * @return int the exit status of the child, 128 + signal number when it was
+ * killed, EXIT_FAILURE when it couldn't be started
  */
 int process_spawn(char *program, char **arg_list);
 
+/**
+ * @brief Starts program without duplicating the caller: posix_spawnp
+ * (clone with CLONE_VM | CLONE_VFORK on glibc) so the cost does not grow
+ * with the size of the parent. Does not wait for the child.
+ *
+ * @param pid to retrieve the proced ID of the child created
+ * @param program to be executed from the path
+ * @param arg_list null terminated list of arguments
+ * @param file_actions dup2/open/close to apply in the child, may be NULL
+ * @param attr signal mask, process group, scheduling..., may be NULL
+ * @param envp environment of the child, NULL inherits the current one
+ * @return int 0 on success, an errno value otherwise
+ */
+int process_spawn_ex(pid_t *pid, const char *program, char *const *arg_list,
+                     const posix_spawn_file_actions_t *file_actions,
+                     const posix_spawnattr_t *attr, char *const *envp);
+
+/**
+ * @brief The classic fork + execvp + waitpid spawn, kept to compare with
+ * the posix_spawn path.
+ *
+ * @param program to be executed from the path
+ * @param arg_list null terminated list of arguments
+ * @return int EXIT_SUCCESS once the child is gone
+ */
+int process_spawn_fork(char *program, char **arg_list);
+
+/**
+ * A child started by process_spawn_async
+ */
+typedef struct process_handle {
+  /**
+   * The proced ID of the child
+   */
+  pid_t pid;
+  /**
+   * Becomes readable (POLLIN) when the child exits, so many children can be
+   * watched with poll/epoll. -1 on kernels without pidfd_open (< 5.3)
+   */
+  int pidfd;
+  /**
+   * CLOCK_MONOTONIC time of the spawn, in ns
+   */
+  uint64_t start_ns;
+} process_handle_t;
+
+/**
+ * How a child ended
+ */
+typedef struct process_result {
+  int exit_code;        // exit status, -1 when killed by a signal
+  int term_signal;      // signal that killed the child, 0 otherwise
+  struct rusage usage;  // resources used by the child (wait4)
+  uint64_t wall_ns;     // time from the spawn until it was reaped
+} process_result_t;
+
+/**
+ * @brief Starts program (see process_spawn_ex) and returns right away with
+ * a handle to wait for it.
+ *
+ * @param handle to retrieve the child pid and pidfd
+ * @return int 0 on success, an errno value otherwise
+ */
+int process_spawn_async(process_handle_t *handle, const char *program,
+                        char *const *arg_list,
+                        const posix_spawn_file_actions_t *file_actions,
+                        const posix_spawnattr_t *attr, char *const *envp);
+
+/**
+ * @brief Reaps the child of handle, collecting its exit status and resource
+ * usage. The pidfd is closed once the child is reaped.
+ *
+ * @param handle from process_spawn_async
+ * @param result to retrieve how the child ended
+ * @param block wait for the child to exit
+ * @return int 0 when reaped, EAGAIN when not blocking and the child still
+ * runs, an errno value otherwise
+ */
+int process_wait(process_handle_t *handle, process_result_t *result,
+                 bool block);
+
+/**
+ * @brief Waits until one of the children exits.
+ *
+ * @param handles children to watch, already reaped ones (pid -1) are skipped
+ * @param count amount of handles
+ * @param timeout_ms -1 waits forever
+ * @return int index of a child ready to be reaped, -1 on timeout or error
+ */
+int process_poll(const process_handle_t *handles, size_t count,
+                 int timeout_ms);
+
+/**
+ * What process_run_jobs does after a job fails
+ */
+typedef enum process_jobs_policy {
+  PROCESS_JOBS_CONTINUE = 0,  // keep running the rest of the queue
+  PROCESS_JOBS_FAIL_FAST = 1  // SIGTERM the running jobs, skip the pending
+} process_jobs_policy_t;
+
+typedef enum process_job_state {
+  PROCESS_JOB_PENDING = 0,
+  PROCESS_JOB_DONE = 1,         // reaped, see result
+  PROCESS_JOB_SPAWN_FAILED = 2, // couldn't be started, see error
+  PROCESS_JOB_SKIPPED = 3       // not started because of fail-fast
+} process_job_state_t;
+
+/**
+ * A command of the queue given to process_run_jobs
+ */
+typedef struct process_job {
+  /**
+   * Null terminated list, arg_list[0] is the program looked up in the path
+   */
+  char *const *arg_list;
+  /**
+   * Pin the child to cpu, false (a zeroed job) lets the runner decide (see
+   * pin_cpus)
+   */
+  bool pin;
+  int cpu;
+  /* Filled by the runner */
+  process_job_state_t state;
+  int error;
+  process_result_t result;
+} process_job_t;
+
+typedef struct process_jobs_opts {
+  size_t max_jobs;               // concurrent children, 0 = online CPUs
+  bool pin_cpus;                 // pin every child to the CPU of its slot
+  process_jobs_policy_t policy;
+} process_jobs_opts_t;
+
+/**
+ * @brief Runs the queue of jobs keeping up to max_jobs children at once.
+ * A job fails when it couldn't be spawned, exits with non zero status or
+ * is killed by a signal.
+ *
+ * @param jobs queue, run in order
+ * @param count amount of jobs
+ * @param opts NULL for the defaults (online CPUs, no pinning, continue)
+ * @return int amount of failed jobs, -1 on error
+ */
+int process_run_jobs(process_job_t *jobs, size_t count,
+                     const process_jobs_opts_t *opts);
+
+/**
+ * Where process_spawn_capture puts a stream (stdout or stderr) of the child
+ */
+typedef struct process_sink {
+  /**
+   * Destination descriptor, the output is spliced into it without passing
+   * through user space. -1 to collect it in buffer instead
+   */
+  int fd;
+  /**
+   * Filled by the call when fd is -1: the whole output, NUL terminated.
+   * Must be released with free
+   */
+  char *buffer;
+  /**
+   * Bytes of output moved
+   */
+  size_t length;
+} process_sink_t;
+
+/**
+ * @brief Runs program connecting its stdout and stderr to pipes and drains
+ * them until the child exits.
+ *
+ * @param program to be executed from the path
+ * @param arg_list null terminated list
+ * @param out sink for stdout, NULL to keep the caller stdout
+ * @param err sink for stderr, NULL to keep the caller stderr. It can be the
+ * same as out to merge both streams
+ * @param result to retrieve how the child ended, can be NULL
+ * @return int 0 on success, an errno value otherwise
+ */
+int process_spawn_capture(const char *program, char *const *arg_list,
+                          process_sink_t *out, process_sink_t *err,
+                          process_result_t *result);
+
+/**
+ * Helper process that spawns children on behalf of its parent
+ */
+typedef struct zygote zygote_t;
+
+/**
+ * Max amount of descriptors handed to a child by zygote_spawn
+ */
+#define ZYGOTE_MAX_FDS 16
+
+/**
+ * @brief Forks the zygote. Call it early, while the process is still small
+ * and has no threads: the zygote is a copy of the caller at this point and
+ * every later spawn is done from it, never from the (grown) caller.
+ *
+ * @return zygote_t* NULL on error
+ */
+zygote_t *zygote_start(void);
+
+/**
+ * @brief Asks the zygote to start program arg_list[0] (looked up in the
+ * path). The calls on a zygote must be serialized by the caller.
+ *
+ * @param zygote from zygote_start
+ * @param pid to retrieve the proced ID of the child
+ * @param arg_list null terminated list
+ * @param envp null terminated environment, NULL for the zygote's one
+ * @param fds fds[i] becomes the descriptor i of the child (stdin, stdout,
+ * stderr...). The ones not given keep the stdin, stdout and stderr the
+ * zygote got from zygote_start, no other descriptor is inherited
+ * @param nfds amount of fds, up to ZYGOTE_MAX_FDS
+ * @return int 0 on success, an errno value otherwise
+ */
+int zygote_spawn(zygote_t *zygote, pid_t *pid, char *const *arg_list,
+                 char *const *envp, const int *fds, size_t nfds);
+
+/**
+ * @brief Collects how the child pid (spawned by the zygote) ended.
+ *
+ * @param zygote from zygote_start
+ * @param pid child from zygote_spawn
+ * @param result to retrieve the exit status, rusage and wall time
+ * @param block wait for the child to exit
+ * @return int 0 on success, EAGAIN when not blocking and the child still
+ * runs, an errno value otherwise
+ */
+int zygote_wait(zygote_t *zygote, pid_t pid, process_result_t *result,
+                bool block);
+
+/**
+ * @brief Descriptor that becomes readable when the zygote has news (to
+ * watch it with poll/epoll and then zygote_wait without blocking).
+ */
+int zygote_fd(const zygote_t *zygote);
+
+/**
+ * @brief Stops the zygote. Children still running are not killed, they
+ * just can't be waited through the zygote anymore.
+ */
+void zygote_stop(zygote_t *zygote);
+
 #endif // processes_H_
\ No newline at end of file
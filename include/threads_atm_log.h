@@ -0,0 +1,79 @@
+/*
+ * @threads_atm_log.h
+ *
+ * @version: 1.0
+ * @Author:  Salvador Z
+ * @brief:   threads_atm_log
+ */
+
+#ifndef threads_atm_log_H_
+#define threads_atm_log_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Bytes of free text a record can hold, longer messages are truncated
+ */
+#define ATM_LOG_TEXT 40U
+
+/**
+ * What a record of the log tells
+ */
+typedef enum atm_log_event {
+  ATM_LOG_MESSAGE  = 0,  // free text
+  ATM_LOG_APPROVED = 1,  // a withdrawl of amount was approved
+  ATM_LOG_DISBURSE = 2,  // amount was disbursed
+} atm_log_event_t;
+
+/**
+ * A record of the log, fixed size (a cache line) and binary: it's copied
+ * to the ring of the thread as is, and formatted later by the flusher
+ */
+typedef struct atm_log_record {
+  uint64_t timestamp_ns;  // CLOCK_REALTIME
+  uint64_t thread;        // pthread_self of the writer
+  uint32_t event;         // atm_log_event_t
+  uint32_t amount;
+  char text[ATM_LOG_TEXT];
+} atm_log_record_t;
+
+/**
+ * @brief Starts the asynchronous log: from now on every thread writes its
+ * records to its own ring and a background thread flushes them to path.
+ * While active, the withdrawl and disbursement messages of the banking
+ * library go to this log instead of stdout.
+ *
+ * @param path of the log file, it's truncated
+ * @return true when started
+ */
+bool atm_log_start(const char *path);
+
+/**
+ * @brief Flushes what is left and stops the log. The threads writing to it
+ * must be done before calling it.
+ */
+void atm_log_stop(void);
+
+/**
+ * @brief Tells whether the asynchronous log is running
+ */
+bool atm_log_active(void);
+
+/**
+ * @brief Writes a record to the ring of the calling thread, never blocks
+ *
+ * @param event of the record
+ * @param amount related to the event
+ * @param text for ATM_LOG_MESSAGE, can be NULL
+ * @return true when logged, false when inactive or the ring was full (the
+ * record is dropped and counted)
+ */
+bool atm_log_write(atm_log_event_t event, uint32_t amount, const char *text);
+
+/**
+ * @brief Records dropped because a ring was full since the log started
+ */
+uint64_t atm_log_dropped(void);
+
+#endif // threads_atm_log_H_
\ No newline at end of file
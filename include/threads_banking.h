@@ -10,42 +10,90 @@
 #define threads_banking_H_
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "threads_ticket_lock.h"
+
 /**
  * The type of locking to use for withdrawls
  */
 typedef enum withdraw_locking {
   ACCOUNT_LOCKING_NON  = 0,  // unsafe implementation (demo purposes)
   ACCOUNT_LOCKING_MTX  = 1,  // use a lock and unlock mutex approach
-  ACCOUNT_LOCKING_MAX  = 2,  // Max number of Locking types defined
+  ACCOUNT_LOCKING_ATOMIC = 2,  // lock-free compare and swap of the state
+  ACCOUNT_LOCKING_RWLOCK = 3,  // inquiries share a rwlock, withdrawls own it
+  ACCOUNT_LOCKING_SPIN = 4,  // fair ticket lock, spins then parks
+  ACCOUNT_LOCKING_LEASE = 5,  // threads withdraw from leased balance
+  ACCOUNT_LOCKING_MAX  = 6,  // Max number of Locking types defined
 } withdraw_locking_t;
 
+/**
+ * The balance and the withdrawl total of an account packed in a word, so
+ * both can be updated by a single compare and swap
+ */
+typedef union account_state {
+  struct {
+    int32_t current_balance;
+    uint32_t withdrawl_total;
+  };
+  uint64_t packed;
+} account_state_t;
+
+struct journal;
+
 /**
  * A structure representing a fictional bank account for withdrawls
  */
 typedef struct account {
+  union {
+    struct {
+      /**
+       * The current balance of the account
+       */
+      int32_t current_balance;
+      /**
+       * The total of approved withdrawls on the account
+       */
+      uint32_t withdrawl_total;
+    };
+    /**
+     * Both values above (same layout as account_state_t), the way they are
+     * accessed while the account is shared: writers store it at once, so a
+     * single load is a consistent snapshot for the inquiries
+     */
+    _Atomic uint64_t state;
+  };
+
   /**
-   * The current balance of the account
+   * The mutex used to lock this account when manipulating values, for thread
+   * safety
    */
-  int32_t current_balance;
+  pthread_mutex_t mutex;
+
   /**
-   * The total of approved withdrawls on the account
+   * The lock used with ACCOUNT_LOCKING_RWLOCK, shared by the inquiries
    */
-  uint32_t withdrawl_total;
+  pthread_rwlock_t rwlock;
 
   /**
-   * The mutex used to lock this account when manipulating values, for thread
-   * safety
+   * The lock used with ACCOUNT_LOCKING_SPIN
    */
-  pthread_mutex_t mutex;
+  ticket_lock_t ticket_lock;
 
   /**
    * The type of locking we use when interacting with the account
    * (for demonstration purposes)
    */
   withdraw_locking_t locktype;
+
+  /**
+   * Write ahead journal of the approved withdrawls, NULL when not journaled
+   * (see account_attach_journal)
+   */
+  struct journal *journal;
+  uint32_t journal_id;
 } account_t;
 
 
@@ -53,11 +101,84 @@ bool withdraw_account_init(account_t *account,
                            unsigned int starting_balance,
                            withdraw_locking_t locktype);
 
+/**
+ * @brief Withdraws amount when the balance allows it, using the locking of
+ * the account. Nothing is printed nor disbursed.
+ *
+ * @param account to withdraw from
+ * @param amount to withdraw
+ * @return true when approved
+ */
+bool account_withdraw(account_t *account, uint32_t amount);
+
+/**
+ * @brief Adds amount to the balance, using the locking of the account. The
+ * withdrawl total is left as it is.
+ *
+ * @param account to deposit into
+ * @param amount to deposit
+ * @return true when deposited, false when the balance would overflow or
+ * the account has a journal (it only records withdrawls)
+ */
+bool account_deposit(account_t *account, uint32_t amount);
+
+/**
+ * @brief Returns the balance leased by the calling thread with
+ * ACCOUNT_LOCKING_LEASE to the accounts, adding what it withdrew from it to
+ * their withdrawl totals. Done when the thread exits, a thread that keeps
+ * running must call it before its accounts go away.
+ *
+ * With ACCOUNT_LOCKING_LEASE a thread reserves a share of the balance with
+ * a single compare and swap and serves its next withdrawls from it without
+ * touching the account. The balance of the account excludes what is
+ * leased, and its withdrawl total includes the leased withdrawls only once
+ * returned; a withdrawl may be declined while other threads still hold
+ * leased balance. A thread leases up to 8 accounts, the withdrawls of any
+ * other account are plain compare and swaps.
+ */
+void account_release_leases(void);
+
+/**
+ * @brief Balance inquiry, the balance and the withdrawl total as a
+ * consistent pair. It's a single atomic load that never blocks nor delays a
+ * withdrawl, except with ACCOUNT_LOCKING_RWLOCK where it takes the lock as a
+ * reader.
+ *
+ * @param account to query
+ * @return account_state_t snapshot of the account
+ */
+account_state_t account_inquiry(account_t *account);
+
+/**
+ * A withdrawl of a batch
+ */
+typedef struct withdraw_request {
+  account_t *account;
+  uint32_t amount;
+  /**
+   * Filled by withdraw_batch
+   */
+  bool approved;
+} withdraw_request_t;
+
+/**
+ * @brief Applies a batch of withdrawls. The requests are grouped by account
+ * and each group is applied under a single lock acquisition (a single
+ * compare and swap with ACCOUNT_LOCKING_ATOMIC). The requests of an account
+ * are decided in the order they have in the batch.
+ *
+ * @param requests to apply, approved is set on each one
+ * @param count amount of requests
+ * @return size_t amount of approved requests
+ */
+size_t withdraw_batch(withdraw_request_t *requests, size_t count);
+
 /**
  * @brief Perform withdrawals from specified account
  *
  * @param account to perform withdrawals
  * @param withdraw_request amount to withdraw
+ * @param key to the atm-log (per thread)
  * @return total withdrawals
  */
 uint32_t do_withdrawls(account_t *account, uint32_t withdraw_request,
@@ -0,0 +1,94 @@
+/*
+ * @threads_journal.h
+ *
+ * @version: 1.0
+ * @Author:  Salvador Z
+ * @brief:   threads_journal
+ */
+
+#ifndef threads_journal_H_
+#define threads_journal_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "threads_banking.h"
+
+/**
+ * Write ahead journal of the approved withdrawls
+ */
+typedef struct journal journal_t;
+
+/**
+ * Counters of a journal since it was opened
+ */
+typedef struct journal_stats {
+  uint64_t records;  // records appended
+  uint64_t commits;  // fdatasync calls, each one commits a group of records
+} journal_stats_t;
+
+/**
+ * @brief Opens (or creates) a journal. A torn record at the end (less than
+ * a record, left by a crash in the middle of a write) is cut off. A record
+ * that doesn't check is never cut, the journal isn't opened instead.
+ *
+ * @param path of the journal file
+ * @param window_us time a commit waits for more records to join its group
+ * before writing them, 0 to write right away (the records arriving during
+ * a commit still form the next group)
+ * @return journal_t* NULL on error
+ */
+journal_t *journal_open(const char *path, unsigned int window_us);
+
+/**
+ * @brief Commits what is pending and closes the journal
+ */
+void journal_close(journal_t *journal);
+
+/**
+ * @brief Applies every record of the journal to the accounts, to be called
+ * on startup before any thread uses them. accounts[id] must be initialized
+ * with the balance they had when the journal was created.
+ *
+ * @param journal to replay
+ * @param accounts indexed by the id given to account_attach_journal
+ * @param count amount of accounts, records of other ids are skipped
+ * @return size_t amount of records applied
+ */
+size_t journal_replay(journal_t *journal, account_t **accounts, size_t count);
+
+/**
+ * @brief Queues the record of a withdrawl, it's not durable until commited
+ *
+ * @return uint64_t sequence of the record, 0 on error
+ */
+uint64_t journal_append(journal_t *journal, uint32_t account_id,
+                        uint32_t amount);
+
+/**
+ * @brief Waits until the record sequence (and every one before it) is on
+ * disk. Concurrent callers share a single fdatasync.
+ *
+ * @return true when durable, false on an I/O error: the records not yet
+ * durable are cut from the file and the journal takes no more records
+ */
+bool journal_commit(journal_t *journal, uint64_t sequence);
+
+/**
+ * @brief Copies the counters of the journal
+ */
+void journal_get_stats(journal_t *journal, journal_stats_t *stats);
+
+/**
+ * @brief From now on every withdrawl approved on account is journaled and
+ * commited before the withdrawl call returns
+ *
+ * @param account to journal
+ * @param journal where to write, NULL to detach
+ * @param id of the account in the journal (see journal_replay)
+ */
+void account_attach_journal(account_t *account, journal_t *journal,
+                            uint32_t id);
+
+#endif // threads_journal_H_
\ No newline at end of file
@@ -0,0 +1,112 @@
+/*
+ * @threads_ledger.h
+ *
+ * @version: 1.0
+ * @Author:  Salvador Z
+ * @brief:   threads_ledger
+ */
+
+#ifndef threads_ledger_H_
+#define threads_ledger_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Size of a cache line, every account of the ledger owns one
+ */
+#define LEDGER_CACHE_LINE 64U
+
+typedef uint32_t ledger_id_t;
+
+/**
+ * An account of the ledger. Aligned and padded to a cache line so threads
+ * working on neighbour accounts don't bounce the same line between cores
+ */
+typedef struct ledger_account {
+  /**
+   * Spinlock of the account, 0 when free
+   */
+  atomic_uint lock;
+  /**
+   * The current balance of the account
+   */
+  int64_t balance;
+  /**
+   * The total of approved withdrawls (and transfers out) on the account
+   */
+  uint64_t withdrawl_total;
+} __attribute__((aligned(LEDGER_CACHE_LINE))) ledger_account_t;
+
+/**
+ * A set of accounts split in shards, each shard a separate allocation
+ */
+typedef struct ledger ledger_t;
+
+/**
+ * @brief Creates a ledger, the account ids go from 0 to accounts - 1
+ *
+ * @param accounts amount of accounts
+ * @param shards amount of shards (rounded up to a power of two), 0 picks
+ * one per 64Ki accounts
+ * @param starting_balance of every account
+ * @return ledger_t* NULL on error
+ */
+ledger_t *ledger_create(size_t accounts, size_t shards,
+                        int64_t starting_balance);
+
+/**
+ * @brief Releases the ledger, no thread may be using it
+ */
+void ledger_destroy(ledger_t *ledger);
+
+/**
+ * @brief Amount of accounts of the ledger
+ */
+size_t ledger_size(const ledger_t *ledger);
+
+/**
+ * @brief Looks up an account
+ *
+ * @return ledger_account_t* NULL when id is out of range
+ */
+ledger_account_t *ledger_account(ledger_t *ledger, ledger_id_t id);
+
+/**
+ * @brief Withdraws amount from the account when its balance allows it
+ *
+ * @return true when approved
+ */
+bool ledger_withdraw(ledger_t *ledger, ledger_id_t id, uint32_t amount);
+
+/**
+ * @brief Deposits amount into the account
+ *
+ * @return true unless id is out of range
+ */
+bool ledger_deposit(ledger_t *ledger, ledger_id_t id, uint32_t amount);
+
+/**
+ * @brief Moves amount between two accounts atomically. Both locks are taken
+ * lowest id first, so concurrent transfers can't deadlock
+ *
+ * @return true when approved, false when the balance of from is not enough
+ * or an id is out of range
+ */
+bool ledger_transfer(ledger_t *ledger, ledger_id_t from, ledger_id_t to,
+                     uint32_t amount);
+
+/**
+ * @brief Current balance of the account, 0 when id is out of range
+ */
+int64_t ledger_balance(ledger_t *ledger, ledger_id_t id);
+
+/**
+ * @brief Sum of the balances of every account (locking one account at a
+ * time, so only exact while no transfer is running)
+ */
+int64_t ledger_total(ledger_t *ledger);
+
+#endif // threads_ledger_H_
\ No newline at end of file
@@ -0,0 +1,92 @@
+/*
+ * @threads_lock_profile.h
+ *
+ * @version: 1.0
+ * @Author:  Salvador Z
+ * @brief:   threads_lock_profile
+ */
+
+#ifndef threads_lock_profile_H_
+#define threads_lock_profile_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Buckets of the histograms, bucket i counts the times in [2^i, 2^(i+1)) ns
+ * (bucket 0 also the ones of 0 ns, the last one everything above)
+ */
+#define LOCK_PROFILE_BUCKETS 32U
+
+/**
+ * Contention counters of a lock
+ */
+typedef struct lock_profile_stats {
+  uint64_t acquisitions;
+  uint64_t trylock_failures;  // acquisitions that found the lock taken
+  uint64_t wait_ns;           // total waiting for the lock
+  uint64_t max_wait_ns;
+  uint64_t hold_ns;           // total holding it
+  uint64_t max_hold_ns;
+  uint64_t wait_histogram[LOCK_PROFILE_BUCKETS];
+  uint64_t hold_histogram[LOCK_PROFILE_BUCKETS];
+} lock_profile_stats_t;
+
+/**
+ * @brief Turns the profiling of the instrumented locks on or off. While off
+ * the locks are taken as usual and nothing is recorded.
+ */
+void lock_profile_enable(bool enable);
+
+/**
+ * @brief Tells whether the profiling is on
+ */
+bool lock_profile_enabled(void);
+
+/**
+ * @brief Monotonic clock in ns, to stamp when a wait for a lock begins
+ */
+uint64_t lock_profile_now(void);
+
+/**
+ * @brief Records an acquisition of lock on the counters of the calling
+ * thread. To be called right after acquiring it.
+ *
+ * @param lock identifies the lock (any address, e.g. the account)
+ * @param wait_begin_ns lock_profile_now when the blocking wait began, 0 when
+ * the first try got the lock
+ */
+void lock_profile_acquired(const void *lock, uint64_t wait_begin_ns);
+
+/**
+ * @brief Records the hold time of lock, to be called right before
+ * releasing it
+ */
+void lock_profile_released(const void *lock);
+
+/**
+ * @brief Merges the counters of every thread for lock
+ *
+ * @param lock to look for
+ * @param stats where to merge them
+ * @return false when lock was never profiled
+ */
+bool lock_profile_get(const void *lock, lock_profile_stats_t *stats);
+
+/**
+ * @brief Merges the counters of every thread and prints them per lock. The
+ * counters of the threads still running are read as they are, call it once
+ * they are done for an exact report.
+ *
+ * @param stream to print to
+ */
+void lock_profile_report(FILE *stream);
+
+/**
+ * @brief Clears every counter, no thread may be using the instrumented
+ * locks meanwhile
+ */
+void lock_profile_reset(void);
+
+#endif // threads_lock_profile_H_
\ No newline at end of file
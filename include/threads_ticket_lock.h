@@ -0,0 +1,82 @@
+/*
+ * @threads_ticket_lock.h
+ *
+ * @version: 1.0
+ * @Author:  Salvador Z
+ * @brief:   threads_ticket_lock
+ */
+
+#ifndef threads_ticket_lock_H_
+#define threads_ticket_lock_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * A fair (first come first served) lock that spins for a while and then
+ * sleeps on a futex, for critical sections of a few instructions. A running
+ * thread may take it ahead of a waiter whose turn came but that hasn't
+ * claimed it yet (e.g. still waking up).
+ */
+typedef struct ticket_lock {
+  /**
+   * The lock itself: free, owned by the turn or barged into
+   */
+  _Atomic uint32_t held;
+  /**
+   * Set while the turn takes the lock, nobody barges in then
+   */
+  _Atomic uint32_t claim;
+  /**
+   * The turn sleeping until a thread that barged in unlocks
+   */
+  _Atomic uint32_t held_waiters;
+  /**
+   * The next ticket to hand out
+   */
+  _Atomic uint32_t next;
+  /**
+   * The ticket whose turn it is, the futex word of the sleepers
+   */
+  _Atomic uint32_t serving;
+  /**
+   * Waiters sleeping on the futex, the unlock only wakes when there are
+   */
+  _Atomic uint32_t parked;
+  /**
+   * Spins that recently were enough to get the lock, adapts the budget
+   */
+  _Atomic uint32_t spins;
+} ticket_lock_t;
+
+/**
+ * @brief Initializes an unlocked lock
+ */
+void ticket_lock_init(ticket_lock_t *lock);
+
+/**
+ * @brief Takes the lock right away when it's free and no turn claims it.
+ * Otherwise takes a ticket and waits for its turn: spinning first, up to an
+ * adaptive budget, then sleeping until the previous owner hands over.
+ * Oversubscribed (more tickets ahead than the CPUs of the affinity mask
+ * and the cgroup quota) it only spins a few rounds before sleeping, as the
+ * turn can't come before the preempted threads ahead run again. Meanwhile
+ * the running threads keep taking the free lock instead of paying a
+ * wakeup per handoff, and the sleeper claims it once it runs.
+ */
+void ticket_lock(ticket_lock_t *lock);
+
+/**
+ * @brief Takes the lock only when it's free and no turn claims it
+ *
+ * @return true when taken
+ */
+bool ticket_trylock(ticket_lock_t *lock);
+
+/**
+ * @brief Hands the lock to the next ticket
+ */
+void ticket_unlock(ticket_lock_t *lock);
+
+#endif // threads_ticket_lock_H_
\ No newline at end of file
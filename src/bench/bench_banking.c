@@ -0,0 +1,434 @@
+/*******************************************************************************
+ * Copyright (C) 2023 by Salvador Z                                            *
+ *                                                                             *
+ * This file is part of ELSU                                                   *
+ *                                                                             *
+ *   Permission is hereby granted, free of charge, to any person obtaining a   *
+ *   copy of this software and associated documentation files (the Software)   *
+ *   to deal in the Software without restriction including without limitation  *
+ *   the rights to use, copy, modify, merge, publish, distribute, sublicense,  *
+ *   and/or sell copies ot the Software, and to permit persons to whom the     *
+ *   Software is furnished to do so, subject to the following conditions:      *
+ *                                                                             *
+ *   The above copyright notice and this permission notice shall be included   *
+ *   in all copies or substantial portions of the Software.                    *
+ *                                                                             *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS   *
+ *   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARANTIES OF MERCHANTABILITY *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL   *
+ *   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR      *
+ *   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,     *
+ *   ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE        *
+ *   OR OTHER DEALINGS IN THE SOFTWARE.                                        *
+ ******************************************************************************/
+
+/**
+ * @file bench_banking.c
+ * @author Salvador Z
+ * @date 17 Oct 2026
+ * @brief Benchmark of the account locking types across thread counts
+ *
+ * Every thread hammers the same account with withdrawls of $1. The account
+ * holds half of what is requested, so it gets drained while contended and
+ * the rest of the requests are declined: at the end the balance must be 0
+ * and the withdrawl total exactly the starting balance (never overdrawn).
+ * A lease account declines while other threads lease the balance, so after
+ * the timed part the threads return their leases and retry their declined
+ * requests until the account is drained, then every $1 is approved once.
+ * With a batch size above 1 the withdrawls are issued with withdraw_batch.
+ * The ledger mode does random transfers among many accounts instead, there
+ * the balance column is the sum of the ledger, which must not change.
+ * With a journal the account withdrawls are journaled with group commit,
+ * the commits column counts the fdatasync calls, and the journal is
+ * replayed into a fresh account which must end in the same state. Before
+ * the points every account mode checks that a batch whose commit fails
+ * (with a declined withdrawl in it) is refunded to the account it came
+ * from, and left out of the journal.
+ * Results are printed as CSV.
+ */
+
+#include "threads_banking.h"
+#include "threads_journal.h"
+#include "threads_ledger.h"
+
+#include <getopt.h>       /*getopt_long*/
+#include <signal.h>       /*sigaction, SIGXFSZ*/
+#include <stdio.h>        /*streams> fopen, fputs*/
+#include <stdlib.h>       /*NULL (stddef), strtoul*/
+#include <string.h>       /*strcmp*/
+#include <sys/resource.h> /*setrlimit*/
+#include <time.h>         /*clock_gettime*/
+#include <unistd.h>       /*unlink*/
+
+#define BENCH_MAX_THREADS 64U
+/* Not a locking type of account_t, the sharded ledger */
+#define BENCH_LEDGER ACCOUNT_LOCKING_MAX
+#define BENCH_MODES (BENCH_LEDGER + 1)
+#define LEDGER_STARTING_BALANCE 100
+#define FAILED_COMMIT_BALANCE 10U
+
+/* The name of the program.  */
+const char *program_name;
+
+static const char *const mode_names[BENCH_MODES] = {
+    "none", "mutex", "atomic", "rwlock", "spin", "lease", "ledger"};
+
+struct bench_thread {
+  account_t *account;
+  ledger_t *ledger;
+  pthread_barrier_t *start;
+  pthread_barrier_t *drained;
+  unsigned long ops;
+  unsigned int batch;
+  unsigned long approved;
+  uint64_t begin_ns;
+  uint64_t end_ns;
+};
+
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Retries the @param declined withdrawls of the thread of @param params in
+ * rounds, each one after every thread returned its leases, until the account
+ * is drained. The round after the last approval finds a balance of 0, so the
+ * threads agree on when to stop.
+ */
+static void bench_retry(struct bench_thread *params, unsigned long declined) {
+  for (;;) {
+    account_release_leases();
+    pthread_barrier_wait(params->drained);
+    const int32_t balance = account_inquiry(params->account).current_balance;
+    /* Nobody withdraws before every thread read the balance */
+    pthread_barrier_wait(params->drained);
+    if (0 >= balance)
+      return;
+    while ((0 < declined) && account_withdraw(params->account, 1U)) {
+      params->approved++;
+      declined--;
+    }
+  }
+}
+
+static void *bench_thread(void *arg) {
+  struct bench_thread *params = (struct bench_thread *)arg;
+
+  withdraw_request_t *requests = NULL;
+
+  if (1U < params->batch) {
+    requests = (withdraw_request_t *)calloc(params->batch, sizeof(*requests));
+    if (NULL == requests) {
+      fprintf(stderr, "Memory allocation for a batch failed\n");
+      exit(EXIT_FAILURE);
+    }
+    for (unsigned int r = 0; r < params->batch; r++)
+      requests[r] = (withdraw_request_t){params->account, 1U, false};
+  }
+  pthread_barrier_wait(params->start);
+  params->begin_ns = now_ns();
+  if (NULL == requests) {
+    for (unsigned long i = 0; i < params->ops; i++)
+      params->approved += account_withdraw(params->account, 1U);
+  } else {
+    for (unsigned long i = 0; i < params->ops; i += params->batch) {
+      size_t count = (params->ops - i < params->batch)
+                         ? (size_t)(params->ops - i)
+                         : (size_t)params->batch;
+      params->approved += withdraw_batch(requests, count);
+    }
+  }
+  params->end_ns = now_ns();
+  free(requests);
+  bench_retry(params, params->ops - params->approved);
+  return arg;
+}
+
+static void *bench_ledger_thread(void *arg) {
+  struct bench_thread *params = (struct bench_thread *)arg;
+  const uint32_t accounts = (uint32_t)ledger_size(params->ledger);
+  uint64_t seed = (uint64_t)(uintptr_t)arg | 1U;
+
+  pthread_barrier_wait(params->start);
+  params->begin_ns = now_ns();
+  for (unsigned long i = 0; i < params->ops; i++) {
+    /* xorshift64, cheap enough not to hide the cost of the transfer */
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    params->approved += ledger_transfer(
+        params->ledger, (ledger_id_t)((seed >> 8) % accounts),
+        (ledger_id_t)((seed >> 36) % accounts), (uint32_t)(seed & 63U) + 1U);
+  }
+  params->end_ns = now_ns();
+  return arg;
+}
+
+/**
+ * Replays the journal at @param path into a fresh account
+ * @return true when it ends like @param account
+ */
+static bool bench_recovery(const char *path, const account_t *account,
+                           unsigned int starting) {
+  account_t recovered;
+  account_t *accounts[1] = {&recovered};
+  journal_t *journal = journal_open(path, 0);
+  bool valid = false;
+
+  if ((NULL != journal) &&
+      withdraw_account_init(&recovered, starting, ACCOUNT_LOCKING_NON)) {
+    journal_replay(journal, accounts, 1);
+    valid = (recovered.current_balance == account->current_balance) &&
+            (recovered.withdrawl_total == account->withdrawl_total);
+    pthread_mutex_destroy(&recovered.mutex);
+  }
+  journal_close(journal);
+  return valid;
+}
+
+/**
+ * Journals a batch of an account of @param mode to @param path with the file
+ * size limit making the commit fail, after a withdrawl was declined
+ * @return true when the account and the journal end as they started
+ */
+static bool bench_failed_commit(int mode, const char *path) {
+  account_t account;
+  journal_t *journal;
+  withdraw_request_t requests[2];
+  struct rlimit limit, no_room;
+  struct sigaction ignore, previous;
+  size_t approved;
+  bool valid;
+
+  unlink(path);
+  if (!withdraw_account_init(&account, FAILED_COMMIT_BALANCE,
+                             (withdraw_locking_t)mode))
+    return false;
+  if (NULL == (journal = journal_open(path, 0)))
+    return false;
+  account_attach_journal(&account, journal, 0);
+  requests[0] = (withdraw_request_t){&account, 4U, false};
+  requests[1] = (withdraw_request_t){&account, 100U, false}; /* declined */
+
+  /* Writing past the limit fails with EFBIG instead of raising SIGXFSZ */
+  memset(&ignore, 0, sizeof(ignore));
+  ignore.sa_handler = SIG_IGN;
+  sigaction(SIGXFSZ, &ignore, &previous);
+  getrlimit(RLIMIT_FSIZE, &limit);
+  no_room = (struct rlimit){0, limit.rlim_max};
+  setrlimit(RLIMIT_FSIZE, &no_room);
+  approved = withdraw_batch(requests, 2);
+  setrlimit(RLIMIT_FSIZE, &limit);
+  sigaction(SIGXFSZ, &previous, NULL);
+
+  account_release_leases();
+  journal_close(journal);
+  valid = (0 == approved) && !requests[0].approved && !requests[1].approved &&
+          (FAILED_COMMIT_BALANCE == account.current_balance) &&
+          (0 == account.withdrawl_total) &&
+          bench_recovery(path, &account, FAILED_COMMIT_BALANCE);
+  if (!valid)
+    fprintf(stderr, "%s: failed commit left balance %d, total %u\n",
+            mode_names[mode], account.current_balance,
+            account.withdrawl_total);
+  pthread_mutex_destroy(&account.mutex);
+  return valid;
+}
+
+/**
+ * Runs @param threads threads doing @param ops operations each (in batches of
+ * @param batch), on an account of @param mode or on a ledger of
+ * @param accounts, and prints the CSV line of the point. The account
+ * withdrawls are journaled to @param journal_path unless it is NULL.
+ * @return false when the account (or the ledger) ended in an invalid state
+ */
+static bool bench_point(FILE *out, int mode, unsigned int threads,
+                        unsigned long ops, unsigned int batch,
+                        size_t accounts, const char *journal_path,
+                        unsigned int window_us) {
+  struct bench_thread params[BENCH_MAX_THREADS];
+  pthread_t ids[BENCH_MAX_THREADS];
+  pthread_barrier_t start, drained;
+  account_t account;
+  ledger_t *ledger = NULL;
+  journal_t *journal = NULL;
+  journal_stats_t stats = {0, 0};
+  const unsigned int starting = (unsigned int)(threads * ops / 2U);
+  unsigned long approved = 0;
+  unsigned int started = 0;
+
+  if (BENCH_LEDGER == mode) {
+    ledger = ledger_create(accounts, 0, LEDGER_STARTING_BALANCE);
+    if (NULL == ledger)
+      return false;
+  } else if (!withdraw_account_init(&account, starting,
+                                    (withdraw_locking_t)mode)) {
+    return false;
+  } else if (NULL != journal_path) {
+    unlink(journal_path); /* every point starts an empty journal */
+    journal = journal_open(journal_path, window_us);
+    if (NULL == journal)
+      return false;
+    account_attach_journal(&account, journal, 0);
+  }
+  pthread_barrier_init(&start, NULL, threads + 1U);
+  pthread_barrier_init(&drained, NULL, threads);
+  for (; started < threads; started++) {
+    params[started] =
+        (struct bench_thread){&account, ledger, &start, &drained, ops,
+                              batch, 0, 0, 0};
+    if (0 != pthread_create(&ids[started], NULL,
+                            (NULL != ledger) ? bench_ledger_thread
+                                             : bench_thread,
+                            &params[started])) {
+      fprintf(stderr, "pthread_create failed for thread %u\n", started);
+      exit(EXIT_FAILURE); /* the barrier would never open */
+    }
+  }
+
+  pthread_barrier_wait(&start);
+  for (unsigned int t = 0; t < started; t++)
+    pthread_join(ids[t], NULL);
+
+  /* From the first thread starting to the last one finishing */
+  uint64_t begin = UINT64_MAX, end = 0;
+  for (unsigned int t = 0; t < started; t++) {
+    approved += params[t].approved;
+    begin = (params[t].begin_ns < begin) ? params[t].begin_ns : begin;
+    end = (params[t].end_ns > end) ? params[t].end_ns : end;
+  }
+  const double seconds = (double)(end - begin) / 1e9;
+
+  int64_t balance;
+  uint64_t withdrawl_total = 0;
+  bool valid;
+  if (NULL != ledger) {
+    balance = ledger_total(ledger);
+    for (size_t id = 0; id < accounts; id++)
+      withdrawl_total +=
+          ledger_account(ledger, (ledger_id_t)id)->withdrawl_total;
+    valid = (balance == (int64_t)accounts * LEDGER_STARTING_BALANCE);
+    ledger_destroy(ledger);
+  } else {
+    balance = account.current_balance;
+    withdrawl_total = account.withdrawl_total;
+    valid = (0 == balance) && (starting == withdrawl_total) &&
+            (starting == approved);
+    if (NULL != journal) {
+      journal_get_stats(journal, &stats);
+      journal_close(journal);
+      valid &= bench_recovery(journal_path, &account, starting);
+    }
+    pthread_mutex_destroy(&account.mutex);
+  }
+  fprintf(out, "%s,%u,%u,%lu,%.6f,%.3f,%lu,%lld,%llu,%llu,%s\n",
+          mode_names[mode], threads, (NULL != ledger) ? 1U : batch,
+          threads * ops, seconds,
+          (double)(threads * ops) / seconds / 1e6, approved,
+          (long long)balance, (unsigned long long)withdrawl_total,
+          (unsigned long long)stats.commits, valid ? "ok" : "VIOLATED");
+
+  pthread_barrier_destroy(&start);
+  pthread_barrier_destroy(&drained);
+  return valid;
+}
+
+/* Prints usage information for the program to STREAM (e.g. stdout or stderr),
+   and exit the program with EXIT_CODE.  Does not return. */
+
+static void print_usage(FILE *stream, int exit_code) {
+  fprintf(stream, "Usage:  %s [options]\n", program_name);
+  fprintf(stream,
+          "  -h  --help              Display this usage information.\n"
+          "  -t  --threads n         Most threads, doubled from 1 (64).\n"
+          "  -n  --ops n             Withdrawls per thread (200000).\n"
+          "  -b  --batch n           Withdrawls per withdraw_batch (1).\n"
+          "  -a  --accounts n        Accounts of the ledger (1000000).\n"
+          "  -m  --mode name         Run only this mode (repeatable).\n"
+          "  -j  --journal filename  Journal the account withdrawls.\n"
+          "  -w  --window us         Group commit window of the journal (0).\n"
+          "  -o  --output filename   Write the results to file.\n"
+          "Modes: none mutex atomic rwlock spin lease ledger (default\n"
+          "       mutex atomic ledger)\n");
+  exit(exit_code);
+}
+
+int main(int argc, char *argv[]) {
+  int next_option;
+  const char *const short_options = "ht:n:b:a:m:j:w:o:";
+  const struct option long_options[] = {
+      {"help", 0, NULL, 'h'},   {"threads", 1, NULL, 't'},
+      {"ops", 1, NULL, 'n'},    {"batch", 1, NULL, 'b'},
+      {"accounts", 1, NULL, 'a'}, {"mode", 1, NULL, 'm'},
+      {"journal", 1, NULL, 'j'}, {"window", 1, NULL, 'w'},
+      {"output", 1, NULL, 'o'}, {NULL, 0, NULL, 0},
+  };
+  bool selected[BENCH_MODES] = {false};
+  bool any_selected = false, valid = true;
+  unsigned int max_threads = BENCH_MAX_THREADS;
+  unsigned long ops = 200000UL;
+  unsigned int batch = 1U;
+  size_t accounts = 1000000U;
+  const char *journal_path = NULL;
+  unsigned int window_us = 0;
+  FILE *out = stdout;
+
+  program_name = argv[0];
+  do {
+    next_option = getopt_long(argc, argv, short_options, long_options, NULL);
+    switch (next_option) {
+    case 'h': print_usage(stdout, 0); break;
+    case 't': max_threads = (unsigned int)strtoul(optarg, NULL, 10); break;
+    case 'n': ops = strtoul(optarg, NULL, 10); break;
+    case 'b': batch = (unsigned int)strtoul(optarg, NULL, 10); break;
+    case 'a': accounts = strtoul(optarg, NULL, 10); break;
+    case 'j': journal_path = optarg; break;
+    case 'w': window_us = (unsigned int)strtoul(optarg, NULL, 10); break;
+    case 'o':
+      out = fopen(optarg, "w");
+      if (NULL == out) {
+        perror(optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'm': {
+      int m = 0;
+      while ((m < BENCH_MODES) && (0 != strcmp(optarg, mode_names[m])))
+        m++;
+      if (BENCH_MODES == m)
+        print_usage(stderr, 1);
+      selected[m] = any_selected = true;
+      break;
+    }
+    case '?': print_usage(stderr, 1); break;
+    case -1: break;
+    default: abort();
+    }
+  } while (-1 != next_option);
+
+  if ((0 == max_threads) || (BENCH_MAX_THREADS < max_threads) || (0 == ops) ||
+      (0 == batch) || (0 == accounts) ||
+      ((unsigned long)BENCH_MAX_THREADS * ops / 2U > (unsigned long)INT32_MAX))
+    print_usage(stderr, 1);
+  if (!any_selected)
+    selected[ACCOUNT_LOCKING_MTX] = selected[ACCOUNT_LOCKING_ATOMIC] =
+        selected[BENCH_LEDGER] = true;
+
+  for (int m = 0; (NULL != journal_path) && (m < BENCH_LEDGER); m++)
+    if (selected[m])
+      valid &= bench_failed_commit(m, journal_path);
+
+  fprintf(out, "mode,threads,batch,ops,seconds,mops_per_s,approved,balance,"
+               "withdrawl_total,commits,invariant\n");
+  for (int m = 0; m < BENCH_MODES; m++)
+    for (unsigned int threads = 1; selected[m] && (threads <= max_threads);
+         threads *= 2U)
+      valid &= bench_point(out, m, threads, ops, batch, accounts,
+                           journal_path, window_us);
+
+  if (stdout != out)
+    fclose(out);
+  return valid ? EXIT_SUCCESS : EXIT_FAILURE;
+}
\ No newline at end of file
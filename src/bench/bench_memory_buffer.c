@@ -0,0 +1,563 @@
+/*******************************************************************************
+ * Copyright (C) 2023 by Salvador Z                                            *
+ *                                                                             *
+ * This file is part of ELSU                                                   *
+ *                                                                             *
+ *   Permission is hereby granted, free of charge, to any person obtaining a   *
+ *   copy of this software and associated documentation files (the Software)   *
+ *   to deal in the Software without restriction including without limitation  *
+ *   the rights to use, copy, modify, merge, publish, distribute, sublicense,  *
+ *   and/or sell copies ot the Software, and to permit persons to whom the     *
+ *   Software is furnished to do so, subject to the following conditions:      *
+ *                                                                             *
+ *   The above copyright notice and this permission notice shall be included   *
+ *   in all copies or substantial portions of the Software.                    *
+ *                                                                             *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS   *
+ *   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARANTIES OF MERCHANTABILITY *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL   *
+ *   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR      *
+ *   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,     *
+ *   ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE        *
+ *   OR OTHER DEALINGS IN THE SOFTWARE.                                        *
+ ******************************************************************************/
+
+/**
+ * @file bench_memory_buffer.c
+ * @author Salvador Z
+ * @date 17 Oct 2026
+ * @brief Benchmark of the memory_buffer I/O paths across buffer sizes
+ *
+ * Every mode is run over a sweep of sizes with the page cache hot (the data
+ * file was just read) and, for the modes reading the data file, cold (its
+ * pages are dropped with POSIX_FADV_DONTNEED before each operation). The
+ * results are printed as CSV or JSON: throughput, read/write system calls
+ * per operation (syscr + syscw of /proc/self/io, io_uring and page faults
+ * are not counted) and latency percentiles.
+ *
+ * @see https://man7.org/linux/man-pages/man5/proc.5.html (/proc/pid/io)
+ */
+
+#include "memory_buffer.h"
+
+#include <errno.h>
+#include <fcntl.h> /*open, posix_fadvise*/
+#include <getopt.h> /*getopt_long*/
+#include <stdio.h>  /*streams> fopen, fputs*/
+#include <stdlib.h> /*NULL (stddef), strtoull*/
+#include <string.h> /*strcmp, strerror, memcmp*/
+#include <time.h>   /*clock_gettime*/
+#include <unistd.h> /*close, unlink*/
+
+#define KiB (1024ULL)
+#define MiB (1024ULL * KiB)
+#define GiB (1024ULL * MiB)
+
+/* Bytes moved per (mode, size) point when the iterations are automatic */
+#define BENCH_TARGET_BYTES (256ULL * MiB)
+#define BENCH_MIN_ITERATIONS 5ULL
+#define BENCH_MAX_ITERATIONS 200ULL
+#define STREAM_BUFS 4U
+#define STREAM_CHUNK (1ULL * MiB)
+
+/* The name of the program.  */
+const char *program_name;
+
+/* System calls counted by reading /proc/self/io itself, see rw_syscalls */
+static uint64_t rw_syscalls_overhead;
+
+/**
+ * What the modes share during a run
+ */
+struct bench_ctx {
+  const char *data_path; /* file of max_size bytes */
+  char *payload;         /* max_size bytes to write */
+  char *stream_ring[STREAM_BUFS];
+  spill_store_t *store;
+  mem_aio_t *aio;
+  tmp_file_handle tmp_file; /* prepared by tmp_read */
+  spill_handle spilled;     /* prepared by spill_read */
+};
+
+/**
+ * A benchmarked operation. prepare runs untimed before each run.
+ */
+struct bench_mode {
+  const char *name;
+  bool reads_data_file; /* the cold page cache case applies */
+  bool (*prepare)(struct bench_ctx *ctx, size_t size);
+  bool (*run)(struct bench_ctx *ctx, size_t size);
+};
+
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Read and write class system calls issued so far by this process
+ */
+static uint64_t rw_syscalls(void) {
+  unsigned long long syscr = 0, syscw = 0;
+  char line[64];
+  FILE *io = fopen("/proc/self/io", "r");
+
+  if (NULL != io) {
+    while (NULL != fgets(line, sizeof(line), io)) {
+      sscanf(line, "syscr: %llu", &syscr);
+      sscanf(line, "syscw: %llu", &syscw);
+    }
+    fclose(io);
+  }
+  return syscr + syscw;
+}
+
+/* -- Modes ---------------------------------------------------------------- */
+
+static bool run_read_block(struct bench_ctx *ctx, size_t size) {
+  char *buf = read_from_file(ctx->data_path, size, true);
+  free(buf);
+  return (NULL != buf);
+}
+
+static bool run_read_nonblock(struct bench_ctx *ctx, size_t size) {
+  char *buf = read_from_file(ctx->data_path, size, false);
+  free(buf);
+  return (NULL != buf);
+}
+
+static bool run_map(struct bench_ctx *ctx, size_t size) {
+  mem_buff_view_t view;
+  volatile char sink = 0;
+
+  if (!map_from_file(ctx->data_path, size, false, &view))
+    return false;
+  /* Fault every page in, a view nobody reads costs nothing */
+  for (size_t i = 0; i < view.length; i += 4 * KiB)
+    sink ^= view.data[i];
+  (void)sink;
+  release_mapped_file(&view);
+  return true;
+}
+
+static bool run_direct(struct bench_ctx *ctx, size_t size) {
+  size_t length = 0;
+  char *buf = read_from_file_direct(ctx->data_path, size, &length, NULL);
+  free(buf);
+  return (NULL != buf) && (length == size);
+}
+
+/**
+ * Stream consumer stopping once @param arg (bytes left) reaches 0
+ */
+static bool consume_chunk(const char *chunk, size_t length, void *arg) {
+  size_t *remaining = (size_t *)arg;
+  (void)chunk;
+  *remaining -= (length < *remaining) ? length : *remaining;
+  return (0 != *remaining);
+}
+
+static bool run_stream(struct bench_ctx *ctx, size_t size) {
+  /* The data file is bigger, stop after size bytes (the reader thread may
+     have read up to STREAM_BUFS chunks ahead by then) */
+  size_t remaining = size;
+  const size_t chunk = (size < STREAM_CHUNK) ? size : STREAM_CHUNK;
+  ssize_t total = stream_from_file(ctx->data_path, ctx->stream_ring,
+                                   STREAM_BUFS, chunk, consume_chunk,
+                                   &remaining);
+  return ((ssize_t)size <= total);
+}
+
+static bool run_aio_read(struct bench_ctx *ctx, size_t size) {
+  mem_aio_result_t result;
+
+  if (!mem_aio_read_file(ctx->aio, ctx->data_path, size, NULL) ||
+      (1 != mem_aio_reap(ctx->aio, &result, 1, 1)))
+    return false;
+  free(result.buffer);
+  return (0 == result.error);
+}
+
+static bool run_tmp_write(struct bench_ctx *ctx, size_t size) {
+  tmp_file_handle handle = write_tmp_mem_buff(ctx->payload, size);
+  if (-1 == handle)
+    return false;
+  close(handle);
+  return true;
+}
+
+static bool run_tmp_write_lz(struct bench_ctx *ctx, size_t size) {
+  tmp_file_handle handle =
+      write_tmp_mem_buff_codec(ctx->payload, size, MEM_CODEC_LZ);
+  if (-1 == handle)
+    return false;
+  close(handle);
+  return true;
+}
+
+static bool prepare_tmp_read(struct bench_ctx *ctx, size_t size) {
+  ctx->tmp_file = write_tmp_mem_buff(ctx->payload, size);
+  return (-1 != ctx->tmp_file);
+}
+
+static bool run_tmp_read(struct bench_ctx *ctx, size_t size) {
+  size_t length = 0;
+  char *buf = read_tmp_mem_buff(ctx->tmp_file, &length);
+  free(buf);
+  return (NULL != buf) && (length == size);
+}
+
+static bool prepare_tmp_read_lz(struct bench_ctx *ctx, size_t size) {
+  ctx->tmp_file = write_tmp_mem_buff_codec(ctx->payload, size, MEM_CODEC_LZ);
+  return (-1 != ctx->tmp_file);
+}
+
+/* Reads the compressed record with the batch reader and checks the data */
+static bool run_tmp_read_lz(struct bench_ctx *ctx, size_t size) {
+  mem_buff_t buf = {NULL, 0};
+  bool valid = (1 == read_tmp_mem_batch(ctx->tmp_file, &buf, 1)) &&
+               (size == buf.length) &&
+               (0 == memcmp(buf.buffer, ctx->payload, size));
+  free(buf.buffer);
+  return valid;
+}
+
+static bool prepare_spill_write(struct bench_ctx *ctx, size_t size) {
+  (void)size;
+  return spill_store_reset(ctx->store);
+}
+
+static bool run_spill_write(struct bench_ctx *ctx, size_t size) {
+  return (-1 != spill_store_write(ctx->store, ctx->payload, size));
+}
+
+static bool prepare_spill_read(struct bench_ctx *ctx, size_t size) {
+  ctx->spilled = -1;
+  if (spill_store_reset(ctx->store))
+    ctx->spilled = spill_store_write(ctx->store, ctx->payload, size);
+  return (-1 != ctx->spilled);
+}
+
+static bool run_spill_read(struct bench_ctx *ctx, size_t size) {
+  size_t length = 0;
+  char *buf = spill_store_read(ctx->store, ctx->spilled, &length);
+  free(buf);
+  return (NULL != buf) && (length == size);
+}
+
+static const struct bench_mode bench_modes[] = {
+    {"read_block", true, NULL, run_read_block},
+    {"read_nonblock", true, NULL, run_read_nonblock},
+    {"map", true, NULL, run_map},
+    {"direct", true, NULL, run_direct},
+    {"stream", true, NULL, run_stream},
+    {"aio_read", true, NULL, run_aio_read},
+    {"tmp_write", false, NULL, run_tmp_write},
+    {"tmp_write_lz", false, NULL, run_tmp_write_lz},
+    {"tmp_read", false, prepare_tmp_read, run_tmp_read},
+    {"tmp_read_lz", false, prepare_tmp_read_lz, run_tmp_read_lz},
+    {"spill_write", false, prepare_spill_write, run_spill_write},
+    {"spill_read", false, prepare_spill_read, run_spill_read},
+};
+#define BENCH_MODES (sizeof(bench_modes) / sizeof(bench_modes[0]))
+
+/* -- Measurement ---------------------------------------------------------- */
+
+/**
+ * The measurements of one (mode, cache, size) point
+ */
+struct bench_point {
+  const char *mode;
+  const char *cache;
+  size_t size;
+  uint64_t iterations;
+  double mb_per_s;
+  double syscalls_per_op;
+  double p50_us, p90_us, p99_us, max_us;
+};
+
+static int compare_u64(const void *a, const void *b) {
+  const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static double percentile_us(const uint64_t *sorted, uint64_t count,
+                            unsigned int pct) {
+  return (double)sorted[((count - 1) * pct) / 100U] / 1e3;
+}
+
+/**
+ * Drops the cached pages of the data file (cold) or reads it once (hot)
+ */
+static void set_cache_state(const char *path, size_t size, bool cold) {
+  int fd = open(path, O_RDONLY);
+  if (-1 != fd) {
+    if (cold)
+      posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    else
+      free(read_from_file(path, size, false));
+    close(fd);
+  }
+}
+
+static bool measure(struct bench_ctx *ctx, const struct bench_mode *mode,
+                    bool cold, size_t size, uint64_t iterations,
+                    struct bench_point *point) {
+  uint64_t *latency = (uint64_t *)malloc(iterations * sizeof(uint64_t));
+  uint64_t total_ns = 0, syscalls = 0;
+  bool success = (NULL != latency);
+
+  if (mode->reads_data_file && !cold)
+    set_cache_state(ctx->data_path, size, false);
+
+  for (uint64_t i = 0; success && (i < iterations); i++) {
+    if (mode->reads_data_file && cold)
+      set_cache_state(ctx->data_path, size, true);
+    if ((NULL != mode->prepare) && !mode->prepare(ctx, size)) {
+      success = false;
+      break;
+    }
+    const uint64_t calls = rw_syscalls();
+    const uint64_t start = now_ns();
+    success = mode->run(ctx, size);
+    latency[i] = now_ns() - start;
+    syscalls += rw_syscalls() - calls - rw_syscalls_overhead;
+    total_ns += latency[i];
+  }
+
+  if (success) {
+    qsort(latency, iterations, sizeof(uint64_t), compare_u64);
+    point->mode = mode->name;
+    point->cache = mode->reads_data_file ? (cold ? "cold" : "hot") : "n/a";
+    point->size = size;
+    point->iterations = iterations;
+    point->mb_per_s =
+        ((double)size * (double)iterations * 1e3) / (double)total_ns;
+    point->syscalls_per_op = (double)syscalls / (double)iterations;
+    point->p50_us = percentile_us(latency, iterations, 50);
+    point->p90_us = percentile_us(latency, iterations, 90);
+    point->p99_us = percentile_us(latency, iterations, 99);
+    point->max_us = (double)latency[iterations - 1] / 1e3;
+  } else {
+    fprintf(stderr, "Mode %s failed at %zu bytes\n", mode->name, size);
+  }
+  free(latency);
+  return success;
+}
+
+static void print_point(FILE *stream, const struct bench_point *point,
+                        bool json, bool first) {
+  if (json)
+    fprintf(stream,
+            "%s  {\"mode\": \"%s\", \"cache\": \"%s\", \"size\": %zu, "
+            "\"iterations\": %llu, \"mb_per_s\": %.2f, "
+            "\"rw_syscalls_per_op\": %.2f, \"p50_us\": %.2f, "
+            "\"p90_us\": %.2f, \"p99_us\": %.2f, \"max_us\": %.2f}",
+            first ? "" : ",\n", point->mode, point->cache, point->size,
+            (unsigned long long)point->iterations, point->mb_per_s,
+            point->syscalls_per_op, point->p50_us, point->p90_us,
+            point->p99_us, point->max_us);
+  else
+    fprintf(stream, "%s,%s,%zu,%llu,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\n",
+            point->mode, point->cache, point->size,
+            (unsigned long long)point->iterations, point->mb_per_s,
+            point->syscalls_per_op, point->p50_us, point->p90_us,
+            point->p99_us, point->max_us);
+  fflush(stream);
+}
+
+/* -- Setup ---------------------------------------------------------------- */
+
+/**
+ * Fills @param buf with text-like data, repetitive enough for the codec
+ */
+static void fill_payload(char *buf, size_t size) {
+  static const char words[] =
+      "2023-03-19T10:42:17 INFO mem_buffer read 4096 bytes from trace.log "
+      "2023-03-19T10:42:18 WARN spill store above threshold, flushing 17 "
+      "2023-03-19T10:42:19 DEBUG worker 3 completed job 4211 in 12 ms\n";
+  unsigned int seed = 1;
+  for (size_t i = 0; i < size; i++) {
+    /* Some noise so the data isn't a single repeated pattern */
+    seed = seed * 1103515245U + 12345U;
+    buf[i] = (0 == (seed >> 28)) ? (char)('a' + (seed >> 16) % 26)
+                                 : words[i % (sizeof(words) - 1)];
+  }
+}
+
+static bool write_data_file(const char *path, const char *payload,
+                            size_t size) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  bool success = (-1 != fd);
+
+  for (size_t done = 0; success && (done < size);) {
+    ssize_t wr_bytes = write(fd, payload + done, size - done);
+    if (0 < wr_bytes)
+      done += (size_t)wr_bytes;
+    else if (EINTR != errno)
+      success = false;
+  }
+  if (success)
+    success = (0 == fsync(fd)); /* clean pages can be dropped */
+  if (!success)
+    fprintf(stderr, "Could not write %s: %s\n", path, strerror(errno));
+  if (-1 != fd)
+    close(fd);
+  return success;
+}
+
+static size_t parse_size(const char *text) {
+  char *end = NULL;
+  unsigned long long value = strtoull(text, &end, 10);
+  switch ((NULL == end) ? '\0' : *end) {
+  case 'k': case 'K': value *= KiB; break;
+  case 'm': case 'M': value *= MiB; break;
+  case 'g': case 'G': value *= GiB; break;
+  default: break;
+  }
+  return (size_t)value;
+}
+
+/* Prints usage information for the program to STREAM (e.g. stdout or stderr),
+   and exit the program with EXIT_CODE.  Does not return. */
+
+static void print_usage(FILE *stream, int exit_code) {
+  fprintf(stream, "Usage:  %s [options]\n", program_name);
+  fprintf(stream,
+          "  -h  --help              Display this usage information.\n"
+          "  -s  --min-size size     Smallest buffer (default 4K).\n"
+          "  -S  --max-size size     Largest buffer (default 1G).\n"
+          "  -f  --factor n          Size multiplier per step (default 4).\n"
+          "  -i  --iterations n      Operations per point (default auto).\n"
+          "  -m  --mode name         Run only this mode (repeatable).\n"
+          "  -d  --dir path          Directory for the data file (/tmp).\n"
+          "  -j  --json              JSON output instead of CSV.\n"
+          "  -o  --output filename   Write the results to file.\n"
+          "Modes:");
+  for (size_t m = 0; m < BENCH_MODES; m++)
+    fprintf(stream, " %s", bench_modes[m].name);
+  fprintf(stream, "\n");
+  exit(exit_code);
+}
+
+int main(int argc, char *argv[]) {
+  int next_option;
+  const char *const short_options = "hs:S:f:i:m:d:jo:";
+  const struct option long_options[] = {
+      {"help", 0, NULL, 'h'},       {"min-size", 1, NULL, 's'},
+      {"max-size", 1, NULL, 'S'},   {"factor", 1, NULL, 'f'},
+      {"iterations", 1, NULL, 'i'}, {"mode", 1, NULL, 'm'},
+      {"dir", 1, NULL, 'd'},        {"json", 0, NULL, 'j'},
+      {"output", 1, NULL, 'o'},     {NULL, 0, NULL, 0},
+  };
+  size_t min_size = 4 * KiB, max_size = 1 * GiB, factor = 4;
+  uint64_t iterations = 0;
+  bool selected[BENCH_MODES] = {false};
+  bool any_selected = false, json = false;
+  const char *dir = "/tmp";
+  FILE *out = stdout;
+
+  program_name = argv[0];
+  do {
+    next_option = getopt_long(argc, argv, short_options, long_options, NULL);
+    switch (next_option) {
+    case 'h': print_usage(stdout, 0); break;
+    case 's': min_size = parse_size(optarg); break;
+    case 'S': max_size = parse_size(optarg); break;
+    case 'f': factor = parse_size(optarg); break;
+    case 'i': iterations = strtoull(optarg, NULL, 10); break;
+    case 'd': dir = optarg; break;
+    case 'j': json = true; break;
+    case 'o':
+      out = fopen(optarg, "w");
+      if (NULL == out) {
+        fprintf(stderr, "Could not open %s: %s\n", optarg, strerror(errno));
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'm': {
+      size_t m = 0;
+      while ((m < BENCH_MODES) && (0 != strcmp(optarg, bench_modes[m].name)))
+        m++;
+      if (BENCH_MODES == m)
+        print_usage(stderr, 1);
+      selected[m] = any_selected = true;
+      break;
+    }
+    case '?': print_usage(stderr, 1); break;
+    case -1: break;
+    default: abort();
+    }
+  } while (next_option != -1);
+
+  if ((0 == min_size) || (min_size > max_size) || (2 > factor))
+    print_usage(stderr, 1);
+
+  /* Shared state: the data file, a payload and the per-mode resources */
+  struct bench_ctx ctx;
+  char data_path[4096];
+  memset(&ctx, 0, sizeof(ctx));
+  snprintf(data_path, sizeof(data_path), "%s/bench_memory_buffer.%d.dat", dir,
+           (int)getpid());
+  ctx.data_path = data_path;
+  ctx.payload = (char *)malloc(max_size);
+  for (unsigned int b = 0; b < STREAM_BUFS; b++)
+    ctx.stream_ring[b] = (char *)malloc(STREAM_CHUNK);
+  ctx.aio = mem_aio_create(1);
+  if ((NULL == ctx.payload) || (NULL == ctx.stream_ring[STREAM_BUFS - 1]) ||
+      (NULL == ctx.aio) || (NULL == (ctx.store = spill_store_open(dir)))) {
+    fprintf(stderr, "Could not set the benchmark up\n");
+    return EXIT_FAILURE;
+  }
+  fill_payload(ctx.payload, max_size);
+  /* Two reads in a row tell how much the probe itself costs */
+  rw_syscalls_overhead = rw_syscalls();
+  rw_syscalls_overhead = rw_syscalls() - rw_syscalls_overhead;
+  if (!write_data_file(data_path, ctx.payload, max_size))
+    return EXIT_FAILURE;
+
+  if (json)
+    fprintf(out, "[\n");
+  else
+    fprintf(out, "mode,cache,size,iterations,mb_per_s,rw_syscalls_per_op,"
+                 "p50_us,p90_us,p99_us,max_us\n");
+
+  bool first = true, success = true;
+  for (size_t m = 0; m < BENCH_MODES; m++) {
+    if (any_selected && !selected[m])
+      continue;
+    for (size_t size = min_size; size <= max_size; size *= factor) {
+      uint64_t count = iterations;
+      if (0 == count) {
+        count = BENCH_TARGET_BYTES / size;
+        if (count < BENCH_MIN_ITERATIONS)
+          count = BENCH_MIN_ITERATIONS;
+        if (count > BENCH_MAX_ITERATIONS)
+          count = BENCH_MAX_ITERATIONS;
+      }
+      for (int cold = 0; cold <= (bench_modes[m].reads_data_file ? 1 : 0);
+           cold++) {
+        struct bench_point point;
+        if (measure(&ctx, &bench_modes[m], cold, size, count, &point)) {
+          print_point(out, &point, json, first);
+          first = false;
+        } else {
+          success = false;
+        }
+      }
+    }
+  }
+  if (json)
+    fprintf(out, "\n]\n");
+
+  unlink(data_path);
+  spill_store_close(ctx.store);
+  mem_aio_destroy(ctx.aio);
+  for (unsigned int b = 0; b < STREAM_BUFS; b++)
+    free(ctx.stream_ring[b]);
+  free(ctx.payload);
+  if (stdout != out)
+    fclose(out);
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
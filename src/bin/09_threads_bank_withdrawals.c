@@ -28,21 +28,45 @@
  * @date 08 Apr 2023
  * @brief File for creating threads to perform several withdrawals
  *
+ * With -b it's a benchmark instead: the threads run for a while a mix of
+ * balance inquiries and withdrawls on random accounts, nothing is printed
+ * meanwhile, and every locking type reports its throughput, the approved
+ * withdrawls per second, the latency percentiles of an operation and
+ * whether an account was overdrawn. A declined withdrawl deposits the
+ * starting balance again (untimed), so the accounts stay funded and the
+ * run measures withdrawls rather than declines. With -p
+ * the contention on the account locks is profiled and reported after every
+ * run.
+ *
  * @see https://linux.die.net/man/3/pthread_join
  */
 
+#include "threads_atm_log.h"
 #include "threads_banking.h"
+#include "threads_lock_profile.h"
 
-#include <stdio.h>  /*streams> fopen, fputs*/
-#include <stdlib.h> /*NULL (stddef)*/
-#include <string.h> /*memset*/
+#include <getopt.h>  /*getopt_long*/
+#include <stdio.h>   /*streams> fopen, fputs*/
+#include <stdlib.h>  /*NULL (stddef)*/
+#include <string.h>  /*memset, strlen*/
+#include <strings.h> /*strcasecmp*/
+#include <time.h>    /*clock_gettime, nanosleep*/
 
 #define STARTING_BALANCE 1000U
 #define WITHDRAW_REQUEST 100U
 #define NUM_THREADS 5U
+/* Latencies below 2^LATENCY_SUB_BITS ns are exact, above that a power of
+   two is split in 2^LATENCY_SUB_BITS buckets (an error below 7%) */
+#define LATENCY_SUB_BITS 4U
+#define LATENCY_SUB_BUCKETS (1U << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((64U - LATENCY_SUB_BITS + 1U) * LATENCY_SUB_BUCKETS)
 
 const char *locking_types[] = {"LOCKING_NONE", "LOCKING_MUTEX",
-                               "LOCKING_SCOPED"};
+                               "LOCKING_ATOMIC", "LOCKING_RWLOCK",
+                               "LOCKING_SPIN", "LOCKING_LEASE"};
+
+/* The name of the program.  */
+const char *program_name;
 
 /* The key used to associate a file descriptor by each thread. */
 pthread_key_t thread_fd_log_key;
@@ -76,14 +100,17 @@ static void *start_withdrawl_thread(void *arg) {
   char thread_log_filename[32u];
   FILE *thread_log_file;
 
-  /* Generate the filename for this thread's log file.  */
-  sprintf(thread_log_filename, "atm_%ssafe-%ld.log",
-          (ACCOUNT_LOCKING_NON == params->account->locktype) ? "non-" : "",
-          (long)pthread_self());
-  /* Open the log file.  */
-  thread_log_file = fopen(thread_log_filename, "w");
-  /* Store the file pointer in thread-specific data under thread_fd_log_key.  */
-  pthread_setspecific(thread_fd_log_key, thread_log_file);
+  /* With the asynchronous log every thread writes to it instead */
+  if (!atm_log_active()) {
+    /* Generate the filename for this thread's log file.  */
+    sprintf(thread_log_filename, "atm_%ssafe-%ld.log",
+            (ACCOUNT_LOCKING_NON == params->account->locktype) ? "non-" : "",
+            (long)pthread_self());
+    /* Open the log file.  */
+    thread_log_file = fopen(thread_log_filename, "w");
+    /* Store the file pointer in thread-specific data (thread_fd_log_key) */
+    pthread_setspecific(thread_fd_log_key, thread_log_file);
+  }
 
   write_atm_log("ATM Statement.", &thread_fd_log_key);
 
@@ -109,20 +136,26 @@ static bool run_withdrawl_threads(struct account *account,
    * An array of pointers to dynamically allocated pthread_t types
    */
   pthread_t **thread_array;
-  thread_array = (pthread_t **)malloc(sizeof(pthread_t *) * num_threads);
-  if (thread_array == NULL) {
+  /**
+   * The parameters of each thread, where it leaves what it disbursed
+   */
+  struct withdraw_threadparams *params;
+  thread_array = (pthread_t **)calloc(num_threads, sizeof(pthread_t *));
+  params = (struct withdraw_threadparams *)calloc(
+      num_threads, sizeof(struct withdraw_threadparams));
+  if ((thread_array == NULL) || (params == NULL)) {
     printf("Memory allocation for pthread pointer failed\n");
+    free(thread_array);
+    free(params);
 
   } else {
     success = true;
-    struct withdraw_threadparams params;
     unsigned int thread;
-    memset(&params, 0, sizeof(struct withdraw_threadparams));
-    params.account = account;
-    params.withdraw_request = withdraw_request;
     pthread_key_create(&thread_fd_log_key, close_atm_log);
 
     for (thread = 0; thread < num_threads; thread++) {
+      params[thread].account = account;
+      params[thread].withdraw_request = withdraw_request;
       thread_array[thread] = (pthread_t *)malloc(sizeof(pthread_t));
       if (thread_array[thread] == NULL) {
         printf("Memory allocation failure for thread array entry failed\n");
@@ -131,11 +164,14 @@ static bool run_withdrawl_threads(struct account *account,
       } else {
         int rc = pthread_create(thread_array[thread],
                                 NULL, // Use default attributes
-                                start_withdrawl_thread, &params);
+                                start_withdrawl_thread, &params[thread]);
         if (rc != 0) {
           printf("pthread_create failed with error %d creating thread %u\n", rc,
                  thread);
+          free(thread_array[thread]);
+          thread_array[thread] = NULL;
           success = false;
+          continue;
         }
         printf("-Started thread [%d] with id %ld\n", thread,
                (unsigned long int)*thread_array[thread]);
@@ -144,36 +180,356 @@ static bool run_withdrawl_threads(struct account *account,
     uint32_t total_withdrawl_from_account = 0;
     for (thread = 0; thread < num_threads; thread++) {
       if (thread_array[thread] != NULL) {
-        int rc = pthread_join(*thread_array[thread], (void *)&params);
+        int rc = pthread_join(*thread_array[thread], NULL);
         if (rc != 0) {
           printf("Attempt to pthread_join thread %u failed with %d\n", thread,
                  rc);
           success = false;
         }
-        total_withdrawl_from_account += params.withdrawn_money;
-        printf("Total Disbursed $%u from atm %d\n", params.withdrawn_money,
-               thread);
+        total_withdrawl_from_account += params[thread].withdrawn_money;
+        printf("Total Disbursed $%u from atm %d\n",
+               params[thread].withdrawn_money, thread);
         free(thread_array[thread]);
       }
     }
     printf("Total Disbursed $%u from account\n", total_withdrawl_from_account);
+    pthread_key_delete(thread_fd_log_key);
     free(thread_array);
+    free(params);
+  }
+  if (lock_profile_enabled()) {
+    lock_profile_report(stdout);
+    lock_profile_reset(); /* every locking type gets its own report */
+  }
+  return success;
+}
+
+/**
+ * What the benchmark threads share
+ */
+struct bench_shared {
+  account_t *accounts;
+  size_t num_accounts;
+  uint32_t refill; /* deposited when a withdrawl is declined */
+  unsigned int read_percent;
+  pthread_barrier_t start;
+  atomic_bool stop;
+};
+
+/**
+ * A structure used to start the benchmark threads, each one on its own
+ * cache lines
+ */
+struct bench_threadparams {
+  _Alignas(64) struct bench_shared *shared;
+  uint64_t seed;
+  unsigned long inquiries;
+  unsigned long withdrawls;
+  unsigned long approved;
+  uint64_t deposited;
+  /**
+   * Latency of the operations of the thread, see latency_bucket
+   */
+  uint64_t latency[LATENCY_BUCKETS];
+};
+
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline unsigned int latency_bucket(uint64_t ns) {
+  if (LATENCY_SUB_BUCKETS > ns)
+    return (unsigned int)ns;
+  const unsigned int msb = 63U - (unsigned int)__builtin_clzll(ns);
+  return (msb - LATENCY_SUB_BITS + 1U) * LATENCY_SUB_BUCKETS +
+         (unsigned int)((ns >> (msb - LATENCY_SUB_BITS)) &
+                        (LATENCY_SUB_BUCKETS - 1U));
+}
+
+/**
+ * The lowest latency that falls in @param bucket
+ */
+static uint64_t bucket_latency(unsigned int bucket) {
+  if (LATENCY_SUB_BUCKETS > bucket)
+    return bucket;
+  const unsigned int msb = bucket / LATENCY_SUB_BUCKETS + LATENCY_SUB_BITS - 1U;
+  return (uint64_t)(LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS)
+         << (msb - LATENCY_SUB_BITS);
+}
+
+/**
+ * @param fraction of the operations of @param histogram (of @param count
+ * operations) that were faster than the latency returned
+ */
+static uint64_t percentile(const uint64_t *histogram, uint64_t count,
+                           double fraction) {
+  const uint64_t rank = (uint64_t)((double)count * fraction);
+  uint64_t seen = 0;
+
+  for (unsigned int b = 0; b < LATENCY_BUCKETS; b++) {
+    seen += histogram[b];
+    if (seen > rank)
+      return bucket_latency(b);
+  }
+  return 0;
+}
+
+static void *start_bench_thread(void *arg) {
+  struct bench_threadparams *params = (struct bench_threadparams *)arg;
+  struct bench_shared *shared = params->shared;
+  uint64_t seed = params->seed;
+  volatile int32_t balance;
+
+  pthread_barrier_wait(&shared->start);
+  while (!atomic_load_explicit(&shared->stop, memory_order_relaxed)) {
+    /* xorshift64, cheap enough not to hide the cost of the operation */
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    account_t *account = &shared->accounts[(seed >> 8) % shared->num_accounts];
+    const uint64_t begin = now_ns();
+    bool declined = false;
+    if ((seed >> 40) % 100U < shared->read_percent) {
+      balance = account_inquiry(account).current_balance;
+      params->inquiries++;
+    } else {
+      declined = !account_withdraw(account, WITHDRAW_REQUEST);
+      params->approved += !declined;
+      params->withdrawls++;
+    }
+    params->latency[latency_bucket(now_ns() - begin)]++;
+    if (declined && account_deposit(account, shared->refill))
+      params->deposited += shared->refill;
+  }
+  (void)balance;
+  return arg;
+}
+
+/**
+ * Runs @param num_threads threads for @param seconds on @param num_accounts
+ * accounts of @param locktype holding @param starting_balance each, with
+ * @param read_percent % of inquiries, and prints the results
+ * @return true when no account was overdrawn
+ */
+static bool run_benchmark(withdraw_locking_t locktype, unsigned int num_threads,
+                          size_t num_accounts, unsigned int starting_balance,
+                          unsigned int read_percent, double seconds) {
+  struct bench_shared shared = {.num_accounts = num_accounts,
+                                .refill = starting_balance,
+                                .read_percent = read_percent};
+  struct bench_threadparams *params;
+  pthread_t *threads;
+  const struct timespec duration = {
+      (time_t)seconds, (long)((seconds - (double)(time_t)seconds) * 1e9)};
+  uint64_t latency[LATENCY_BUCKETS] = {0};
+  unsigned long inquiries = 0, withdrawls = 0, approved = 0;
+  uint64_t deposited = 0;
+  unsigned int started = 0;
+  bool success = true;
+
+  shared.accounts = (account_t *)calloc(num_accounts, sizeof(account_t));
+  params = (struct bench_threadparams *)aligned_alloc(
+      _Alignof(struct bench_threadparams),
+      num_threads * sizeof(struct bench_threadparams));
+  threads = (pthread_t *)calloc(num_threads, sizeof(pthread_t));
+  if ((NULL == shared.accounts) || (NULL == params) || (NULL == threads)) {
+    printf("Memory allocation for the benchmark failed\n");
+    free(shared.accounts);
+    free(params);
+    free(threads);
+    return false;
+  }
+  for (size_t a = 0; a < num_accounts; a++)
+    withdraw_account_init(&shared.accounts[a], starting_balance, locktype);
+  atomic_init(&shared.stop, false);
+  pthread_barrier_init(&shared.start, NULL, num_threads + 1U);
+
+  for (; started < num_threads; started++) {
+    memset(&params[started], 0, sizeof(params[started]));
+    params[started].shared = &shared;
+    params[started].seed = 0x9E3779B97F4A7C15ULL * (started + 1U);
+    if (0 != pthread_create(&threads[started], NULL, start_bench_thread,
+                            &params[started])) {
+      printf("pthread_create failed creating thread %u\n", started);
+      exit(EXIT_FAILURE); /* the barrier would never open */
+    }
+  }
+
+  pthread_barrier_wait(&shared.start);
+  const uint64_t begin = now_ns();
+  nanosleep(&duration, NULL);
+  atomic_store_explicit(&shared.stop, true, memory_order_relaxed);
+  for (unsigned int thread = 0; thread < started; thread++)
+    pthread_join(threads[thread], NULL);
+  const double elapsed = (double)(now_ns() - begin) / 1e9;
+
+  for (unsigned int thread = 0; thread < started; thread++) {
+    inquiries += params[thread].inquiries;
+    withdrawls += params[thread].withdrawls;
+    approved += params[thread].approved;
+    deposited += params[thread].deposited;
+    for (unsigned int b = 0; b < LATENCY_BUCKETS; b++)
+      latency[b] += params[thread].latency[b];
   }
+
+  /* Never overdrawn, and every approved withdrawl and deposit accounted
+     exactly once */
+  uint64_t withdrawl_total = 0, held = 0;
+  for (size_t a = 0; a < num_accounts; a++) {
+    const account_state_t state = account_inquiry(&shared.accounts[a]);
+    withdrawl_total += state.withdrawl_total;
+    held += (uint64_t)state.current_balance + state.withdrawl_total;
+    success &= (0 <= state.current_balance);
+    pthread_mutex_destroy(&shared.accounts[a].mutex);
+    pthread_rwlock_destroy(&shared.accounts[a].rwlock);
+  }
+  success &= ((uint64_t)approved * WITHDRAW_REQUEST == withdrawl_total) &&
+             ((uint64_t)num_accounts * starting_balance + deposited == held);
+
+  const uint64_t ops = inquiries + withdrawls;
+  printf("%-16s %10.3f %10.3f %10lu %10lu %10lu %8llu %8llu %8llu  %s\n",
+         locking_types[locktype], (double)ops / elapsed / 1e6,
+         (double)approved / elapsed / 1e6, inquiries, withdrawls, approved,
+         (unsigned long long)percentile(latency, ops, 0.50),
+         (unsigned long long)percentile(latency, ops, 0.99),
+         (unsigned long long)percentile(latency, ops, 0.999),
+         success ? "ok" : "OVERDRAWN");
+  if (lock_profile_enabled()) {
+    lock_profile_report(stdout);
+    lock_profile_reset();
+  }
+
+  pthread_barrier_destroy(&shared.start);
+  free(shared.accounts);
+  free(params);
+  free(threads);
   return success;
 }
 
-int main() {
+/* Prints usage information for the program to STREAM (e.g. stdout or stderr),
+   and exit the program with EXIT_CODE.  Does not return. */
+
+static void print_usage(FILE *stream, int exit_code) {
+  fprintf(stream, "Usage:  %s [options]\n", program_name);
+  fprintf(stream,
+          "  -h  --help              Display this usage information.\n"
+          "  -l  --log filename      Asynchronous ATM log instead of one\n"
+          "                          file per thread.\n"
+          "  -p  --profile           Report the contention on the account\n"
+          "                          lock.\n"
+          "  -t  --threads n         Threads withdrawing (5).\n"
+          "  -b  --bench             Benchmark the locking types instead.\n"
+          "Benchmark options:\n"
+          "  -a  --accounts n        Accounts picked at random (1).\n"
+          "  -s  --balance n         Starting balance of each account,\n"
+          "                          deposited again when a withdrawl is\n"
+          "                          declined (1000000).\n"
+          "  -r  --read-percent n    Balance inquiries among the\n"
+          "                          operations (0).\n"
+          "  -d  --duration seconds  Duration of each run (1).\n"
+          "  -m  --mode name         Benchmark only this locking type\n"
+          "                          (repeatable): none mutex atomic rwlock\n"
+          "                          spin lease, default every thread safe\n"
+          "                          one.\n");
+  exit(exit_code);
+}
+
+int main(int argc, char *argv[]) {
   bool success = false;
+  int next_option;
+  const char *const short_options = "hl:pt:ba:s:r:d:m:";
+  const struct option long_options[] = {
+      {"help", 0, NULL, 'h'},
+      {"log", 1, NULL, 'l'},
+      {"profile", 0, NULL, 'p'},
+      {"threads", 1, NULL, 't'},
+      {"bench", 0, NULL, 'b'},
+      {"accounts", 1, NULL, 'a'},
+      {"balance", 1, NULL, 's'},
+      {"read-percent", 1, NULL, 'r'},
+      {"duration", 1, NULL, 'd'},
+      {"mode", 1, NULL, 'm'},
+      {NULL, 0, NULL, 0},
+  };
+  const char *log_filename = NULL;
+  unsigned int num_threads = NUM_THREADS;
+  bool bench = false;
+  bool selected[ACCOUNT_LOCKING_MAX] = {false};
+  bool any_selected = false;
+  size_t num_accounts = 1U;
+  unsigned int starting_balance = 1000000U;
+  int read_percent = 0;
+  double seconds = 1.0;
 
   struct account useraccount;
 
+  program_name = argv[0];
+  do {
+    next_option = getopt_long(argc, argv, short_options, long_options, NULL);
+    switch (next_option) {
+    case 'h': print_usage(stdout, 0); break;
+    case 'l': log_filename = optarg; break;
+    case 'p': lock_profile_enable(true); break;
+    case 't': num_threads = (unsigned int)strtoul(optarg, NULL, 10); break;
+    case 'b': bench = true; break;
+    case 'a': num_accounts = strtoul(optarg, NULL, 10); break;
+    case 's': starting_balance = (unsigned int)strtoul(optarg, NULL, 10); break;
+    case 'r':
+      read_percent = atoi(optarg);
+      if ((0 > read_percent) || (100 < read_percent))
+        print_usage(stderr, 1);
+      break;
+    case 'd': seconds = strtod(optarg, NULL); break;
+    case 'm': {
+      int m = ACCOUNT_LOCKING_NON;
+      /* The names without the prefix, e.g. mutex for LOCKING_MUTEX */
+      while ((ACCOUNT_LOCKING_MAX > m) &&
+             (0 != strcasecmp(optarg,
+                              locking_types[m] + strlen("LOCKING_"))))
+        m++;
+      if (ACCOUNT_LOCKING_MAX == m)
+        print_usage(stderr, 1);
+      selected[m] = any_selected = true;
+      break;
+    }
+    case '?': print_usage(stderr, 1); break;
+    case -1: break;
+    default: abort();
+    }
+  } while (-1 != next_option);
+
+  if ((0 == num_threads) || (0 == num_accounts) || !(0.0 < seconds) ||
+      (INT32_MAX < starting_balance))
+    print_usage(stderr, 1);
+
+  if (bench) {
+    success = true;
+    printf("%u threads, %zu accounts, %d%% inquiries, %.1f s\n", num_threads,
+           num_accounts, read_percent, seconds);
+    printf("%-16s %10s %10s %10s %10s %10s %8s %8s %8s\n", "locking",
+           "Mops/s", "Mapprov/s", "inquiries", "withdrawls", "approved",
+           "p50 ns", "p99 ns", "p999 ns");
+    for (int m = ACCOUNT_LOCKING_NON; m < ACCOUNT_LOCKING_MAX; m++)
+      if (any_selected ? selected[m] : (ACCOUNT_LOCKING_NON != m))
+        success &= run_benchmark((withdraw_locking_t)m, num_threads,
+                                 num_accounts, starting_balance,
+                                 (unsigned int)read_percent, seconds);
+    return success ? 0 : -1;
+  }
+
+  /* Optional file for the asynchronous atm log */
+  if ((NULL != log_filename) && !atm_log_start(log_filename))
+    return -1;
+
   for (int locking_type = ACCOUNT_LOCKING_NON;
        locking_type < ACCOUNT_LOCKING_MAX; locking_type++) {
     printf("Running with locking type: %s\n", locking_types[locking_type]);
     withdraw_account_init(&useraccount, STARTING_BALANCE,
                           (withdraw_locking_t)locking_type);
 
-    if (run_withdrawl_threads(&useraccount, WITHDRAW_REQUEST, NUM_THREADS)) {
+    if (run_withdrawl_threads(&useraccount, WITHDRAW_REQUEST, num_threads)) {
       if (useraccount.withdrawl_total > (unsigned long)STARTING_BALANCE) {
         printf("\nWithdrew a total of $%u from an account which only contained "
                "$%u!\n",
@@ -189,5 +545,10 @@ int main() {
       printf("Error starting withdrawl threads\n");
     }
   }
+  if (atm_log_active()) {
+    atm_log_stop();
+    printf("ATM log written to %s (%llu records dropped)\n", log_filename,
+           (unsigned long long)atm_log_dropped());
+  }
   return success ? 0 : -1;
 }
\ No newline at end of file
@@ -0,0 +1,116 @@
+/*******************************************************************************
+ * Copyright (C) 2023 by Salvador Z                                            *
+ *                                                                             *
+ * This file is part of ELSU                                                   *
+ *                                                                             *
+ *   Permission is hereby granted, free of charge, to any person obtaining a   *
+ *   copy of this software and associated documentation files (the Software)   *
+ *   to deal in the Software without restriction including without limitation  *
+ *   the rights to use, copy, modify, merge, publish, distribute, sublicense,  *
+ *   and/or sell copies ot the Software, and to permit persons to whom the     *
+ *   Software is furnished to do so, subject to the following conditions:      *
+ *                                                                             *
+ *   The above copyright notice and this permission notice shall be included   *
+ *   in all copies or substantial portions of the Software.                    *
+ *                                                                             *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS   *
+ *   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARANTIES OF MERCHANTABILITY *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL   *
+ *   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR      *
+ *   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,     *
+ *   ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE        *
+ *   OR OTHER DEALINGS IN THE SOFTWARE.                                        *
+ ******************************************************************************/
+
+/**
+ * @file spawn_latency.c
+ * @author Salvador Z
+ * @date 17 Oct 2026
+ * @brief File for comparing fork + exec against posix_spawn as the parent
+ * grows
+ *
+ * `fork` copies the page tables of the parent (and marks every page copy on
+ * write) before the child can exec, so its cost follows the resident size.
+ * `posix_spawn` shares the address space with the child until the exec.
+ * The zygote, forked at the start while the parent is small, spawns on
+ * behalf of the parent so its cost doesn't depend on the parent size.
+ *
+ * Usage: 11_spawn_latency [max RSS in MiB (1024)] [spawns per point (50)]
+ *
+ * @see https://man7.org/linux/man-pages/man3/posix_spawn.3.html
+ */
+
+#include <stdio.h>  /*streams> fopen, fputs*/
+#include <stdlib.h> /*NULL (stddef), atoi*/
+#include <string.h> /*memset*/
+#include <time.h>   /*clock_gettime*/
+
+#include "processes.h"
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+/**
+ * Average time in us of @param spawns runs of /bin/true with @param spawn
+ */
+static double time_spawn(int (*spawn)(char *, char **), unsigned int spawns) {
+  char *arg_list[] = {"true", NULL};
+  const double start = now_us();
+  for (unsigned int i = 0; i < spawns; i++)
+    spawn("true", arg_list);
+  return (now_us() - start) / spawns;
+}
+
+/**
+ * Same as time_spawn but spawning through @param zygote
+ */
+static double time_zygote(zygote_t *zygote, unsigned int spawns) {
+  char *arg_list[] = {"true", NULL};
+  process_result_t result;
+  pid_t pid;
+  const double start = now_us();
+  for (unsigned int i = 0; i < spawns; i++)
+    if (0 == zygote_spawn(zygote, &pid, arg_list, NULL, NULL, 0))
+      zygote_wait(zygote, pid, &result, true);
+  return (now_us() - start) / spawns;
+}
+
+int main(int argc, char *argv[]) {
+  const size_t max_rss_mib = (argc > 1) ? (size_t)atoi(argv[1]) : 1024U;
+  const unsigned int spawns = (argc > 2) ? (unsigned int)atoi(argv[2]) : 50U;
+  char *heap = NULL;
+  size_t rss_mib = 0;
+  zygote_t *zygote = zygote_start(); /* while we are still small */
+
+  if (0 == spawns) {
+    fprintf(stderr, "The amount of spawns must be at least 1\n");
+    zygote_stop(zygote);
+    return EXIT_FAILURE;
+  }
+  printf("%10s %16s %16s %16s\n", "RSS(MiB)", "fork+exec(us)",
+         "posix_spawn(us)", "zygote(us)");
+  for (;;) {
+    printf("%10zu %16.1f %16.1f %16.1f\n", rss_mib,
+           time_spawn(process_spawn_fork, spawns),
+           time_spawn(process_spawn, spawns),
+           (NULL != zygote) ? time_zygote(zygote, spawns) : 0.0);
+
+    rss_mib = (0 == rss_mib) ? 64U : rss_mib * 4U;
+    if (rss_mib > max_rss_mib)
+      break;
+    free(heap);
+    heap = (char *)malloc(rss_mib << 20);
+    if (NULL == heap) {
+      fprintf(stderr, "Could not allocate %zu MiB\n", rss_mib);
+      break;
+    }
+    /* Touch every page so it is resident, and mapped in the page tables */
+    memset(heap, 1, rss_mib << 20);
+  }
+  free(heap);
+  zygote_stop(zygote);
+  return 0;
+}
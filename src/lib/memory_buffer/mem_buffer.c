@@ -44,10 +44,15 @@
 #include <unistd.h> /*read, write*/
 
 char* read_from_file(const char *filename, const size_t length, const bool block) {
+  return read_from_file_pool(filename, length, block, NULL);
+}
+
+char *read_from_file_pool(const char *filename, const size_t length,
+                          const bool block, mem_pool_t *pool) {
   char *buf = NULL;
 
   /*Buffer allocated*/
-  buf = (char *)malloc(length);
+  buf = (char *)mem_pool_alloc(pool, length);
   if (NULL != buf) {
     /*Open the file*/
     int fd =
@@ -64,14 +69,14 @@ char* read_from_file(const char *filename, const size_t length, const bool block
              S_IRWXU | S_IRWXG | S_IRWXO);
     if (fd == -1) {
       printf("Error %d (%s) opening %s\n", errno, strerror(errno), filename);
-      free(buf);
+      mem_pool_free(pool, buf);
       buf = NULL;
     } else { /*Read the file*/
       const size_t readlen = read(fd, buf, length);
 
       if (readlen != length) {
         int return_err = errno;
-        free(buf);
+        mem_pool_free(pool, buf);
         buf = NULL;
         if (!block && return_err == EAGAIN) {
           printf("EAGAIN returned from read(), no data available to read\n");
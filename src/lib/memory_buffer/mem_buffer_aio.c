@@ -0,0 +1,521 @@
+/*******************************************************************************
+ * Copyright (C) 2023 by Salvador Z                                            *
+ *                                                                             *
+ * This file is part of ELSU                                                   *
+ *                                                                             *
+ *   Permission is hereby granted, free of charge, to any person obtaining a   *
+ *   copy of this software and associated documentation files (the Software)   *
+ *   to deal in the Software without restriction including without limitation  *
+ *   the rights to use, copy, modify, merge, publish, distribute, sublicense,  *
+ *   and/or sell copies ot the Software, and to permit persons to whom the     *
+ *   Software is furnished to do so, subject to the following conditions:      *
+ *                                                                             *
+ *   The above copyright notice and this permission notice shall be included   *
+ *   in all copies or substantial portions of the Software.                    *
+ *                                                                             *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS   *
+ *   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARANTIES OF MERCHANTABILITY *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL   *
+ *   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR      *
+ *   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,     *
+ *   ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE        *
+ *   OR OTHER DEALINGS IN THE SOFTWARE.                                        *
+ ******************************************************************************/
+
+/**
+ * @file mem_buffer_aio.c
+ * @author Salvador Z
+ * @date 17 Oct 2026
+ * @brief File for keeping many memory buffer reads and spills in flight
+ *
+ * Operations are driven by a small state machine per slot. With io_uring
+ * every transfer is queued as a READV/WRITEV entry and continued from its
+ * completion (short transfers are resubmitted for the rest). Without it the
+ * very same state machine runs the transfers with `preadv`/`pwritev` on
+ * submission. The ring is set up with the raw system calls, there is no
+ * dependency on liburing.
+ *
+ * @see https://man7.org/linux/man-pages/man2/io_uring_setup.2.html
+ * @see https://man7.org/linux/man-pages/man2/io_uring_enter.2.html
+ */
+
+#include "memory_buffer.h"
+#include "mem_buffer_io.h"
+
+#include <errno.h>
+#include <fcntl.h> /*open*/
+#include <stdio.h> /*streams*/
+#include <string.h> /*strerror, memset*/
+#include <sys/mman.h> /*mmap*/
+#include <sys/stat.h> /*fstat, S_ISREG*/
+#include <sys/syscall.h> /*SYS_io_uring_**/
+#include <sys/uio.h> /*struct iovec, preadv*/
+#include <unistd.h> /*syscall, close*/
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(SYS_io_uring_setup)
+#include <linux/io_uring.h>
+#define MEM_AIO_URING 1
+#endif
+#endif
+#ifndef MEM_AIO_URING
+#define MEM_AIO_URING 0
+#endif
+
+/**
+ * The state of an operation while it's in flight
+ */
+struct aio_slot {
+  mem_aio_result_t result;
+  int fd;
+  bool owns_fd; /* READ_FILE opens (and closes) its own file */
+  bool reading; /* direction of the current transfer */
+  int stage;    /* RELOAD: 0 while reading the length, 1 for the data */
+  size_t header;
+  struct iovec iov[2];
+  int iovcnt;
+  off_t offset; /* file offset of the next transfer, -1 for streams */
+  int next_free;
+};
+
+#if MEM_AIO_URING
+/**
+ * The mapped submission and completion queues of the ring
+ */
+struct aio_ring {
+  int fd;
+  void *sq_ptr;
+  size_t sq_size;
+  void *cq_ptr;
+  size_t cq_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+  unsigned to_submit;
+};
+#endif
+
+struct mem_aio {
+  unsigned int depth;
+  struct aio_slot *slots;
+  int free_slot;       /* head of the free list */
+  unsigned int inflight; /* slots in use, reaped or not */
+  unsigned int *done;    /* FIFO of completed slots */
+  unsigned int done_head;
+  unsigned int done_count;
+  bool async;
+#if MEM_AIO_URING
+  struct aio_ring ring;
+#endif
+};
+
+#if MEM_AIO_URING
+static bool ring_setup(struct aio_ring *ring, unsigned int entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  memset(ring, 0, sizeof(*ring));
+
+  ring->fd = (int)syscall(SYS_io_uring_setup, entries, &params);
+  if (-1 == ring->fd)
+    return false;
+
+  ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_size > ring->sq_size)
+      ring->sq_size = ring->cq_size;
+    ring->cq_size = 0; /* shares the SQ mapping */
+  }
+  ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  ring->cq_ptr = ring->sq_ptr;
+  if ((MAP_FAILED != ring->sq_ptr) && (0 != ring->cq_size))
+    ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_CQ_RING);
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = (struct io_uring_sqe *)mmap(
+      NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+      ring->fd, IORING_OFF_SQES);
+
+  if ((MAP_FAILED == ring->sq_ptr) || (MAP_FAILED == ring->cq_ptr) ||
+      (MAP_FAILED == (void *)ring->sqes)) {
+    if (MAP_FAILED != (void *)ring->sqes)
+      munmap(ring->sqes, ring->sqes_size);
+    if ((MAP_FAILED != ring->cq_ptr) && (0 != ring->cq_size))
+      munmap(ring->cq_ptr, ring->cq_size);
+    if (MAP_FAILED != ring->sq_ptr)
+      munmap(ring->sq_ptr, ring->sq_size);
+    close(ring->fd);
+    return false;
+  }
+
+  ring->sq_head = (unsigned *)((char *)ring->sq_ptr + params.sq_off.head);
+  ring->sq_tail = (unsigned *)((char *)ring->sq_ptr + params.sq_off.tail);
+  ring->sq_mask = (unsigned *)((char *)ring->sq_ptr + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)((char *)ring->sq_ptr + params.sq_off.array);
+  ring->cq_head = (unsigned *)((char *)ring->cq_ptr + params.cq_off.head);
+  ring->cq_tail = (unsigned *)((char *)ring->cq_ptr + params.cq_off.tail);
+  ring->cq_mask = (unsigned *)((char *)ring->cq_ptr + params.cq_off.ring_mask);
+  ring->cqes =
+      (struct io_uring_cqe *)((char *)ring->cq_ptr + params.cq_off.cqes);
+  return true;
+}
+
+static void ring_teardown(struct aio_ring *ring) {
+  munmap(ring->sqes, ring->sqes_size);
+  if (0 != ring->cq_size)
+    munmap(ring->cq_ptr, ring->cq_size);
+  munmap(ring->sq_ptr, ring->sq_size);
+  close(ring->fd);
+}
+
+/**
+ * Queues the current transfer of slot @param index, submitted on next enter.
+ * There is always room: at most one entry per slot and depth <= entries.
+ */
+static void ring_queue(struct aio_ring *ring, struct aio_slot *slot,
+                       unsigned int index) {
+  const unsigned tail = *ring->sq_tail; /* only this thread writes it */
+  const unsigned sqe_idx = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[sqe_idx];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = slot->reading ? IORING_OP_READV : IORING_OP_WRITEV;
+  sqe->fd = slot->fd;
+  sqe->addr = (unsigned long)slot->iov;
+  sqe->len = (unsigned)slot->iovcnt;
+  sqe->off = (__u64)slot->offset;
+  sqe->user_data = index;
+  ring->sq_array[sqe_idx] = sqe_idx;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring->to_submit++;
+}
+#endif
+
+/**
+ * Moves slot @param index to the FIFO of completed operations
+ */
+static void aio_finish(mem_aio_t *aio, unsigned int index) {
+  struct aio_slot *slot = &aio->slots[index];
+
+  if (slot->owns_fd)
+    close(slot->fd);
+  slot->owns_fd = false;
+  if ((0 != slot->result.error) && (NULL != slot->result.buffer)) {
+    free(slot->result.buffer);
+    slot->result.buffer = NULL;
+  }
+  aio->done[(aio->done_head + aio->done_count) % aio->depth] = index;
+  aio->done_count++;
+}
+
+/**
+ * Accounts @param res (bytes transferred or -errno) on slot @param index
+ * @return true if the slot has another transfer to issue
+ */
+static bool aio_progress(mem_aio_t *aio, unsigned int index, ssize_t res) {
+  struct aio_slot *slot = &aio->slots[index];
+
+  if ((-EINTR == res) || (-EAGAIN == res))
+    return true; /* retry the same transfer */
+  if (0 > res) {
+    slot->result.error = (int)-res;
+  } else if (0 == res) {
+    slot->result.error = ENODATA; /* EOF before the expected length */
+  } else {
+    if (-1 != slot->offset)
+      slot->offset += res;
+    struct iovec *rest = mem_io_advance(slot->iov, &slot->iovcnt, (size_t)res);
+    if (0 < slot->iovcnt) { /* short transfer, keep the rest at iov[0] */
+      memmove(slot->iov, rest, (size_t)slot->iovcnt * sizeof(*rest));
+      return true;
+    }
+    if ((MEM_AIO_RELOAD == slot->result.op) && (0 == slot->stage)) {
+      /* The length is known, now fetch the data of the record */
+      slot->stage = 1;
+      slot->result.length = slot->header;
+      slot->result.buffer = (char *)malloc(slot->header);
+      if (NULL == slot->result.buffer) {
+        slot->result.error = ENOMEM;
+      } else if (0 != slot->header) {
+        slot->iov[0].iov_base = slot->result.buffer;
+        slot->iov[0].iov_len = slot->header;
+        slot->iovcnt = 1;
+        return true;
+      }
+    }
+  }
+  aio_finish(aio, index);
+  return false;
+}
+
+/**
+ * Issues the current transfer of slot @param index: queued on the ring, or
+ * run to completion right away on the synchronous fallback
+ */
+static void aio_issue(mem_aio_t *aio, unsigned int index) {
+  struct aio_slot *slot = &aio->slots[index];
+#if MEM_AIO_URING
+  if (aio->async) {
+    ring_queue(&aio->ring, slot, index);
+    return;
+  }
+#endif
+  ssize_t res;
+  do {
+    if (slot->reading)
+      res = (-1 == slot->offset)
+                ? readv(slot->fd, slot->iov, slot->iovcnt)
+                : preadv(slot->fd, slot->iov, slot->iovcnt, slot->offset);
+    else
+      res = pwritev(slot->fd, slot->iov, slot->iovcnt, slot->offset);
+    if (-1 == res)
+      res = -errno;
+  } while (aio_progress(aio, index, res));
+}
+
+/**
+ * Takes a free slot for @param op, NULL when depth operations are pending
+ */
+static struct aio_slot *aio_slot_get(mem_aio_t *aio, mem_aio_op_t op,
+                                     void *user_data) {
+  struct aio_slot *slot = NULL;
+  if (-1 != aio->free_slot) {
+    slot = &aio->slots[aio->free_slot];
+    aio->free_slot = slot->next_free;
+    aio->inflight++;
+    memset(&slot->result, 0, sizeof(slot->result));
+    slot->result.op = op;
+    slot->result.user_data = user_data;
+    slot->result.handle = -1;
+    slot->owns_fd = false;
+    slot->stage = 0;
+  }
+  return slot;
+}
+
+static void aio_slot_put(mem_aio_t *aio, unsigned int index) {
+  aio->slots[index].next_free = aio->free_slot;
+  aio->free_slot = (int)index;
+  aio->inflight--;
+}
+
+mem_aio_t *mem_aio_create(unsigned int depth) {
+  mem_aio_t *aio = NULL;
+
+  if (0 == depth) {
+    printf("The depth of the aio context must be at least 1\n");
+  } else if (NULL == (aio = (mem_aio_t *)calloc(1, sizeof(*aio)))) {
+    printf("Memory allocation for the aio context failed\n");
+  } else {
+    aio->depth = depth;
+    aio->slots = (struct aio_slot *)calloc(depth, sizeof(struct aio_slot));
+    aio->done = (unsigned int *)calloc(depth, sizeof(unsigned int));
+    if ((NULL == aio->slots) || (NULL == aio->done)) {
+      printf("Memory allocation for the aio slots failed\n");
+      free(aio->slots);
+      free(aio->done);
+      free(aio);
+      return NULL;
+    }
+    for (unsigned int i = 0; i < depth; i++)
+      aio->slots[i].next_free = (i + 1 < depth) ? (int)(i + 1) : -1;
+    aio->free_slot = 0;
+#if MEM_AIO_URING
+    aio->async = ring_setup(&aio->ring, depth);
+#endif
+  }
+  return aio;
+}
+
+bool mem_aio_is_async(const mem_aio_t *aio) { return aio->async; }
+
+bool mem_aio_read_file(mem_aio_t *aio, const char *filename, size_t length,
+                       void *user_data) {
+  struct stat file_stat;
+  struct aio_slot *slot = aio_slot_get(aio, MEM_AIO_READ_FILE, user_data);
+  if (NULL == slot)
+    return false;
+
+  const unsigned int index = (unsigned int)(slot - aio->slots);
+  slot->fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (-1 == slot->fd) {
+    printf("Error %d (%s) opening %s\n", errno, strerror(errno), filename);
+    aio_slot_put(aio, index);
+    return false;
+  }
+  slot->owns_fd = true;
+  slot->reading = true;
+  /* Pipes and FIFOs are read from their current position */
+  slot->offset = ((0 == fstat(slot->fd, &file_stat)) &&
+                  S_ISREG(file_stat.st_mode)) ? 0 : -1;
+  slot->result.length = length;
+  slot->result.buffer = (char *)malloc(length);
+  if ((NULL == slot->result.buffer) || (0 == length)) {
+    slot->result.error = (0 == length) ? 0 : ENOMEM;
+    aio_finish(aio, index);
+  } else {
+    slot->iov[0].iov_base = slot->result.buffer;
+    slot->iov[0].iov_len = length;
+    slot->iovcnt = 1;
+    aio_issue(aio, index);
+  }
+  return true;
+}
+
+bool mem_aio_spill(mem_aio_t *aio, spill_store_t *store, const char *buffer,
+                   size_t length, void *user_data) {
+  struct aio_slot *slot = aio_slot_get(aio, MEM_AIO_SPILL, user_data);
+  if (NULL == slot)
+    return false;
+
+  const unsigned int index = (unsigned int)(slot - aio->slots);
+  /* Same record layout and reservation as spill_store_write */
+  slot->header = length;
+  slot->fd = store->fd;
+  slot->reading = false;
+  slot->offset =
+      atomic_fetch_add(&store->tail, (off_t)(sizeof(length) + length));
+  slot->result.handle = slot->offset;
+  slot->iov[0].iov_base = &slot->header;
+  slot->iov[0].iov_len = sizeof(slot->header);
+  slot->iov[1].iov_base = (void *)buffer;
+  slot->iov[1].iov_len = length;
+  slot->iovcnt = (0 == length) ? 1 : 2;
+  aio_issue(aio, index);
+  return true;
+}
+
+bool mem_aio_reload(mem_aio_t *aio, spill_store_t *store, spill_handle handle,
+                    void *user_data) {
+  struct aio_slot *slot = aio_slot_get(aio, MEM_AIO_RELOAD, user_data);
+  if (NULL == slot)
+    return false;
+
+  const unsigned int index = (unsigned int)(slot - aio->slots);
+  slot->fd = store->fd;
+  slot->reading = true;
+  slot->offset = handle;
+  slot->result.handle = handle;
+  slot->iov[0].iov_base = &slot->header;
+  slot->iov[0].iov_len = sizeof(slot->header);
+  slot->iovcnt = 1;
+  aio_issue(aio, index);
+  return true;
+}
+
+#if MEM_AIO_URING
+/**
+ * Takes back the entries the kernel didn't consume and completes their
+ * slots with @param error. Without SQPOLL the kernel only reads the
+ * submission queue inside io_uring_enter, so the tail can be moved back.
+ */
+static void ring_fail_queued(mem_aio_t *aio, int error) {
+  struct aio_ring *ring = &aio->ring;
+  const unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+  for (unsigned entry = head; *ring->sq_tail != entry; entry++) {
+    const unsigned sqe_idx = ring->sq_array[entry & *ring->sq_mask];
+    const unsigned int index = (unsigned int)ring->sqes[sqe_idx].user_data;
+    aio->slots[index].result.error = error;
+    aio_finish(aio, index);
+  }
+  __atomic_store_n(ring->sq_tail, head, __ATOMIC_RELEASE);
+  ring->to_submit = 0;
+}
+
+/**
+ * Submits the queued entries and waits for @param min_complete completions,
+ * every completion found is processed. On a hard error the entries not
+ * submitted yet are completed with it.
+ * @return int 0, or the errno of io_uring_enter
+ */
+static int ring_enter(mem_aio_t *aio, unsigned int min_complete) {
+  struct aio_ring *ring = &aio->ring;
+  unsigned int flags = (0 < min_complete) ? IORING_ENTER_GETEVENTS : 0;
+  int error = 0;
+
+  if ((0 != ring->to_submit) || (0 != min_complete)) {
+    long rc = syscall(SYS_io_uring_enter, ring->fd, ring->to_submit,
+                      min_complete, flags, NULL, 0);
+    if (0 <= rc) {
+      ring->to_submit -= (unsigned)rc;
+    } else if ((EINTR != errno) && (EAGAIN != errno) && (EBUSY != errno)) {
+      error = errno;
+      printf("io_uring_enter failed with %s\n", strerror(error));
+    }
+  }
+
+  unsigned head = *ring->cq_head;
+  while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+    const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+    const unsigned int index = (unsigned int)cqe->user_data;
+    const ssize_t res = cqe->res;
+    head++;
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    if (aio_progress(aio, index, res))
+      ring_queue(ring, &aio->slots[index], index);
+  }
+  if (0 != error)
+    ring_fail_queued(aio, error);
+  return error;
+}
+#endif
+
+size_t mem_aio_reap(mem_aio_t *aio, mem_aio_result_t *results, size_t max,
+                    size_t min_wait) {
+  size_t reaped = 0;
+
+  if (min_wait > max)
+    min_wait = max;
+  if (min_wait > aio->inflight)
+    min_wait = aio->inflight;
+
+#if MEM_AIO_URING
+  if (aio->async) {
+    /* submit and pick what is already complete */
+    int error = ring_enter(aio, 0);
+    while ((0 == error) &&
+           ((aio->done_count < min_wait) || (0 != aio->ring.to_submit)))
+      error = ring_enter(aio, (aio->done_count < min_wait) ? 1 : 0);
+  }
+#endif
+
+  while ((reaped < max) && (0 != aio->done_count)) {
+    const unsigned int index = aio->done[aio->done_head];
+    aio->done_head = (aio->done_head + 1) % aio->depth;
+    aio->done_count--;
+    results[reaped++] = aio->slots[index].result;
+    aio_slot_put(aio, index);
+  }
+  return reaped;
+}
+
+void mem_aio_destroy(mem_aio_t *aio) {
+  mem_aio_result_t result;
+
+  if (NULL == aio)
+    return;
+  /* The kernel may still write into the slots, drain them first */
+  while (0 != aio->inflight) {
+    if (0 == mem_aio_reap(aio, &result, 1, 1))
+      break;
+    free(result.buffer);
+  }
+#if MEM_AIO_URING
+  if (aio->async)
+    ring_teardown(&aio->ring);
+#endif
+  free(aio->done);
+  free(aio->slots);
+  free(aio);
+}
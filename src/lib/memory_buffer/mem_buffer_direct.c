@@ -0,0 +1,152 @@
+/*******************************************************************************
+ * Copyright (C) 2023 by Salvador Z                                            *
+ *                                                                             *
+ * This file is part of ELSU                                                   *
+ *                                                                             *
+ *   Permission is hereby granted, free of charge, to any person obtaining a   *
+ *   copy of this software and associated documentation files (the Software)   *
+ *   to deal in the Software without restriction including without limitation  *
+ *   the rights to use, copy, modify, merge, publish, distribute, sublicense,  *
+ *   and/or sell copies ot the Software, and to permit persons to whom the     *
+ *   Software is furnished to do so, subject to the following conditions:      *
+ *                                                                             *
+ *   The above copyright notice and this permission notice shall be included   *
+ *   in all copies or substantial portions of the Software.                    *
+ *                                                                             *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS   *
+ *   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARANTIES OF MERCHANTABILITY *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL   *
+ *   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR      *
+ *   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,     *
+ *   ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE        *
+ *   OR OTHER DEALINGS IN THE SOFTWARE.                                        *
+ ******************************************************************************/
+
+/**
+ * @file mem_buffer_direct.c
+ * @author Salvador Z
+ * @date 17 Oct 2026
+ * @brief File for reading big files without going through the page cache
+ *
+ * `O_DIRECT` transfers need the buffer, the file offset and the length
+ * aligned to the logical block of the device. The buffer is allocated with
+ * `posix_memalign` and rounded up to the block, the last (partial) block is
+ * requested whole and the kernel stops at EOF.
+ *
+ * @see https://man7.org/linux/man-pages/man2/open.2.html (O_DIRECT)
+ * @see https://linux.die.net/man/3/posix_memalign
+ */
+
+#define _GNU_SOURCE /*O_DIRECT*/
+#include "memory_buffer.h"
+
+#include <errno.h>
+#include <fcntl.h> /*open, posix_fadvise*/
+#include <stdio.h> /*streams*/
+#include <string.h> /*strerror*/
+#include <sys/stat.h> /*fstat*/
+#include <time.h> /*clock_gettime*/
+#include <unistd.h> /*pread, close*/
+
+/* Covers 512 bytes and 4 KiB logical blocks */
+#define DIRECT_ALIGN 4096U
+/* Bytes per read, big enough to keep the device busy */
+#define DIRECT_CHUNK (8U << 20)
+
+static inline size_t align_up(size_t value) {
+  return (value + DIRECT_ALIGN - 1) & ~((size_t)DIRECT_ALIGN - 1);
+}
+
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Reads @param length bytes from @param fd into the aligned @param buf
+ * @return ssize_t bytes read (less than length only at EOF), -1 on error
+ */
+static ssize_t direct_read(int fd, char *buf, size_t length, bool *direct) {
+  size_t done = 0;
+
+  while (done < length) {
+    /* Whole blocks while direct, the exact rest once buffered */
+    size_t chunk = length - done;
+    if (*direct)
+      chunk = align_up(chunk);
+    if (chunk > DIRECT_CHUNK)
+      chunk = DIRECT_CHUNK;
+
+    ssize_t rd_bytes = pread(fd, buf + done, chunk, (off_t)done);
+    if (0 < rd_bytes) {
+      done += (size_t)rd_bytes;
+      if (*direct && (0 != (done % DIRECT_ALIGN)) && (done < length)) {
+        /* An unaligned short read, finish the tail through the cache */
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+        *direct = false;
+      }
+    } else if (0 == rd_bytes) {
+      break; /*EOF*/
+    } else if (EINTR != errno) {
+      return -1;
+    }
+  }
+  return (ssize_t)((done > length) ? length : done);
+}
+
+char *read_from_file_direct(const char *filename, size_t length,
+                            size_t *read_length, mem_io_stats_t *stats) {
+  char *buf = NULL;
+  struct stat file_stat;
+  bool direct = true;
+  const uint64_t start = now_ns();
+
+  *read_length = 0;
+  int fd = open(filename, O_RDONLY | O_DIRECT);
+  if ((-1 == fd) && (EINVAL == errno)) { /* e.g. tmpfs */
+    direct = false;
+    fd = open(filename, O_RDONLY);
+  }
+  if (-1 == fd) {
+    printf("Error %d (%s) opening %s\n", errno, strerror(errno), filename);
+    return NULL;
+  }
+
+  if (-1 == fstat(fd, &file_stat)) {
+    printf("Error %d (%s) on fstat %s\n", errno, strerror(errno), filename);
+  } else {
+    if ((0 == length) || (length > (size_t)file_stat.st_size))
+      length = (size_t)file_stat.st_size;
+    /* Room for the whole last block, it is read entirely */
+    if (0 != posix_memalign((void **)&buf, DIRECT_ALIGN,
+                            align_up(length) + DIRECT_ALIGN)) {
+      printf("Could not allocate %zu aligned bytes\n", length);
+      buf = NULL;
+    } else {
+      ssize_t rd_bytes = direct_read(fd, buf, length, &direct);
+      if (-1 == rd_bytes) {
+        printf("Error returned from read(), errno is %d (%s)\n", errno,
+               strerror(errno));
+        free(buf);
+        buf = NULL;
+      } else {
+        *read_length = (size_t)rd_bytes;
+      }
+    }
+  }
+  if (!direct) /* Don't leave behind what was pulled into the cache */
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+
+  if (NULL != stats) {
+    stats->bytes = *read_length;
+    stats->elapsed_ns = now_ns() - start;
+    stats->mb_per_s = (0 == stats->elapsed_ns)
+                          ? 0.0
+                          : ((double)stats->bytes * 1e3) /
+                                (double)stats->elapsed_ns;
+    stats->direct = direct;
+  }
+  return buf;
+}
@@ -0,0 +1,187 @@
+/*
+ * @mem_buffer_io.h
+ *
+ * @version: 1.0
+ * @Author:  Salvador Z
+ * @brief:   I/O helpers shared by the memory_buffer sources (not installed)
+ */
+
+#ifndef MEM_BUFFER_IO_H_
+#define MEM_BUFFER_IO_H_
+
+#include "memory_buffer.h"
+
+#include <errno.h>
+#include <poll.h> /*poll*/
+#include <stdatomic.h>
+#include <stdlib.h> /*NULL (stddef)*/
+#include <sys/types.h> /*ssize_t*/
+#include <sys/uio.h> /*pwritev*/
+#include <unistd.h> /*read, pread*/
+
+/* Most iovecs a single vectored call accepts (UIO_MAXIOV on Linux) */
+#define MEM_IO_MAX_IOV 1024
+
+/**
+ * A spill store (spill_store_t), shared with the asynchronous context
+ */
+struct spill_store {
+  /**
+   * File descriptor of the unlinked backing file
+   */
+  int fd;
+  /**
+   * Offset where the next record is appended, reserved atomically so
+   * several threads can spill into the same store
+   */
+  _Atomic off_t tail;
+};
+
+/**
+ * @brief Waits until fd is ready for events, used when a non-blocking fd
+ * returns EAGAIN in the middle of a transfer.
+ *
+ * @return int 0 when ready, -1 on error
+ */
+static inline int mem_io_wait(int fd, short events) {
+  struct pollfd pfd = {.fd = fd, .events = events, .revents = 0};
+  int rc;
+  do {
+    rc = poll(&pfd, 1, -1);
+  } while ((-1 == rc) && (EINTR == errno));
+  return (-1 == rc) ? -1 : 0;
+}
+
+/**
+ * @brief Reads until length bytes are in buf or the end of file is reached.
+ * Short reads and EINTR are retried.
+ *
+ * @return ssize_t bytes read (less than length only at EOF), -1 on error
+ */
+static inline ssize_t mem_io_read_full(int fd, void *buf, size_t length) {
+  size_t done = 0;
+  while (done < length) {
+    ssize_t rd_bytes = read(fd, (char *)buf + done, length - done);
+    if (0 < rd_bytes) {
+      done += (size_t)rd_bytes;
+    } else if (0 == rd_bytes) {
+      break; /*EOF*/
+    } else if (EINTR == errno) {
+      continue;
+    } else if ((EAGAIN == errno) && (0 == mem_io_wait(fd, POLLIN))) {
+      continue;
+    } else {
+      return -1;
+    }
+  }
+  return (ssize_t)done;
+}
+
+/**
+ * @brief Reads length bytes at offset, retrying short reads and EINTR.
+ *
+ * @return ssize_t bytes read (less than length only at EOF), -1 on error
+ */
+static inline ssize_t mem_io_pread_full(int fd, void *buf, size_t length,
+                                        off_t offset) {
+  size_t done = 0;
+  while (done < length) {
+    ssize_t rd_bytes =
+        pread(fd, (char *)buf + done, length - done, offset + (off_t)done);
+    if (0 < rd_bytes)
+      done += (size_t)rd_bytes;
+    else if (0 == rd_bytes)
+      break; /*EOF*/
+    else if (EINTR != errno)
+      return -1;
+  }
+  return (ssize_t)done;
+}
+
+/**
+ * @brief Skips the first done bytes of the iovec array, so a partial
+ * transfer can be resumed. The iovecs are modified in place.
+ *
+ * @return struct iovec* first iovec with bytes left (iov + iovcnt if none)
+ */
+static inline struct iovec *mem_io_advance(struct iovec *iov, int *iovcnt,
+                                           size_t done) {
+  while ((0 < *iovcnt) && (done >= iov->iov_len)) {
+    done -= iov->iov_len;
+    iov++;
+    (*iovcnt)--;
+  }
+  if (0 < *iovcnt) {
+    iov->iov_base = (char *)iov->iov_base + done;
+    iov->iov_len -= done;
+  }
+  return iov;
+}
+
+/**
+ * @brief Writes all the iovecs at offset, resuming after partial writes and
+ * EINTR. The iovecs are consumed (modified) in the process.
+ *
+ * @return int 0 once everything is written, -1 on error
+ */
+static inline int mem_io_pwritev_full(int fd, struct iovec *iov, int iovcnt,
+                                      off_t offset) {
+  while (0 < iovcnt) {
+    ssize_t wr_bytes = pwritev(
+        fd, iov, (iovcnt < MEM_IO_MAX_IOV) ? iovcnt : MEM_IO_MAX_IOV, offset);
+    if (0 <= wr_bytes) {
+      offset += wr_bytes;
+      iov = mem_io_advance(iov, &iovcnt, (size_t)wr_bytes);
+    } else if (EINTR != errno) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Fills all the iovecs from offset, resuming after short reads and
+ * EINTR. The iovecs are consumed (modified) in the process.
+ *
+ * @return ssize_t bytes read (less than requested only at EOF), -1 on error
+ */
+static inline ssize_t mem_io_preadv_full(int fd, struct iovec *iov,
+                                         int iovcnt, off_t offset) {
+  size_t done = 0;
+  while (0 < iovcnt) {
+    ssize_t rd_bytes = preadv(
+        fd, iov, (iovcnt < MEM_IO_MAX_IOV) ? iovcnt : MEM_IO_MAX_IOV,
+        offset + (off_t)done);
+    if (0 < rd_bytes) {
+      done += (size_t)rd_bytes;
+      iov = mem_io_advance(iov, &iovcnt, (size_t)rd_bytes);
+    } else if (0 == rd_bytes) {
+      break; /*EOF*/
+    } else if (EINTR != errno) {
+      return -1;
+    }
+  }
+  return (ssize_t)done;
+}
+
+/**
+ * @brief Lays out count buffers as length-prefixed records (length followed
+ * by the data), the lengths are referenced in place from bufs.
+ *
+ * @return struct iovec* 2 * count iovecs. Must be free. NULL on failure
+ */
+static inline struct iovec *mem_io_records_iov(const mem_buff_t *bufs,
+                                               size_t count) {
+  struct iovec *iov = (struct iovec *)malloc(2 * count * sizeof(*iov));
+  if (NULL != iov) {
+    for (size_t i = 0; i < count; i++) {
+      iov[2 * i].iov_base = (void *)&bufs[i].length;
+      iov[2 * i].iov_len = sizeof(bufs[i].length);
+      iov[2 * i + 1].iov_base = bufs[i].buffer;
+      iov[2 * i + 1].iov_len = bufs[i].length;
+    }
+  }
+  return iov;
+}
+
+#endif // MEM_BUFFER_IO_H_
\ No newline at end of file
@@ -0,0 +1,179 @@
+/*******************************************************************************
+ * Copyright (C) 2023 by Salvador Z                                            *
+ *                                                                             *
+ * This file is part of ELSU                                                   *
+ *                                                                             *
+ *   Permission is hereby granted, free of charge, to any person obtaining a   *
+ *   copy of this software and associated documentation files (the Software)   *
+ *   to deal in the Software without restriction including without limitation  *
+ *   the rights to use, copy, modify, merge, publish, distribute, sublicense,  *
+ *   and/or sell copies ot the Software, and to permit persons to whom the     *
+ *   Software is furnished to do so, subject to the following conditions:      *
+ *                                                                             *
+ *   The above copyright notice and this permission notice shall be included   *
+ *   in all copies or substantial portions of the Software.                    *
+ *                                                                             *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS   *
+ *   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARANTIES OF MERCHANTABILITY *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL   *
+ *   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR      *
+ *   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,     *
+ *   ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE        *
+ *   OR OTHER DEALINGS IN THE SOFTWARE.                                        *
+ ******************************************************************************/
+
+/**
+ * @file mem_buffer_loader.c
+ * @author Salvador Z
+ * @date 17 Oct 2026
+ * @brief File for loading many files at once with a pool of threads
+ *
+ * Every worker claims the next file with an atomic counter and writes its
+ * outcome in the slot of the file, so the results keep the order of the
+ * paths without any other synchronization.
+ *
+ * @see https://linux.die.net/man/3/pthread_create
+ */
+
+#include "memory_buffer.h"
+#include "mem_buffer_io.h"
+
+#include <errno.h>
+#include <fcntl.h> /*open*/
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h> /*streams*/
+#include <string.h> /*memset*/
+#include <sys/stat.h> /*fstat*/
+#include <time.h> /*clock_gettime*/
+#include <unistd.h> /*sysconf, close*/
+
+#define LOADER_MIN_WORKERS 4U
+#define LOADER_MAX_WORKERS 64U
+
+/**
+ * The work shared by the loader threads
+ */
+struct loader_job {
+  const char *const *paths;
+  const size_t *lengths;
+  size_t count;
+  mem_pool_t *pool;
+  mem_load_result_t *results;
+  atomic_size_t next; /* next file to be claimed */
+};
+
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Loads @param path into @param result, @return the errno of the failure
+ * (ENODATA when the file ends before the @param length asked for)
+ */
+static int load_file(const char *path, size_t length, mem_pool_t *pool,
+                     mem_load_result_t *result) {
+  struct stat file_stat;
+  const bool whole_file = (0 == length);
+  int error = 0;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+  if (-1 == fd)
+    return errno;
+  if ((0 == length) && (-1 == fstat(fd, &file_stat))) {
+    error = errno;
+  } else {
+    if (0 == length)
+      length = (size_t)file_stat.st_size;
+    result->buffer = (char *)mem_pool_alloc(pool, length);
+    if (NULL == result->buffer) {
+      error = ENOMEM;
+    } else {
+      ssize_t rd_bytes = mem_io_read_full(fd, result->buffer, length);
+      if ((-1 == rd_bytes) || (!whole_file && (rd_bytes < (ssize_t)length))) {
+        error = (-1 == rd_bytes) ? errno : ENODATA;
+        mem_pool_free(pool, result->buffer);
+        result->buffer = NULL;
+      } else {
+        result->length = (size_t)rd_bytes;
+      }
+    }
+  }
+  close(fd);
+  return error;
+}
+
+/**
+ * Worker entry point, @param arg is the struct loader_job
+ */
+static void *loader_worker(void *arg) {
+  struct loader_job *job = (struct loader_job *)arg;
+  size_t index;
+
+  while ((index = atomic_fetch_add(&job->next, 1)) < job->count) {
+    mem_load_result_t *result = &job->results[index];
+    const size_t length = (NULL == job->lengths) ? 0 : job->lengths[index];
+    const uint64_t start = now_ns();
+
+    memset(result, 0, sizeof(*result));
+    result->error = load_file(job->paths[index], length, job->pool, result);
+    result->elapsed_ns = now_ns() - start;
+  }
+  return NULL;
+}
+
+size_t load_files_parallel(const char *const *paths, const size_t *lengths,
+                           size_t count, unsigned int workers,
+                           mem_pool_t *pool, mem_load_result_t *results) {
+  struct loader_job job = {
+      .paths = paths,
+      .lengths = lengths,
+      .count = count,
+      .pool = pool,
+      .results = results,
+  };
+  pthread_t *threads = NULL;
+  unsigned int started = 0;
+  size_t loaded = 0;
+
+  atomic_init(&job.next, 0);
+  if (0 == workers) { /* I/O bound, more threads than CPUs pays off */
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    workers = (0 < cpus) ? 2U * (unsigned int)cpus : LOADER_MIN_WORKERS;
+    if (workers < LOADER_MIN_WORKERS)
+      workers = LOADER_MIN_WORKERS;
+    if (workers > LOADER_MAX_WORKERS)
+      workers = LOADER_MAX_WORKERS;
+  }
+  if (workers > count)
+    workers = (unsigned int)count;
+
+  if (1 < workers) {
+    threads = (pthread_t *)malloc(sizeof(pthread_t) * (workers - 1));
+    if (NULL == threads)
+      printf("Memory allocation for the loader threads failed\n");
+  }
+  for (unsigned int i = 0; (NULL != threads) && (i < workers - 1); i++) {
+    int rc = pthread_create(&threads[i], NULL, loader_worker, &job);
+    if (0 != rc) {
+      /* Not fatal, the threads already running share the work */
+      printf("pthread_create failed with error %d creating loader %u\n", rc,
+             i);
+      break;
+    }
+    started++;
+  }
+
+  /* The calling thread is a worker too */
+  loader_worker(&job);
+  for (unsigned int i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+
+  for (size_t i = 0; i < count; i++)
+    if (0 == results[i].error)
+      loaded++;
+  return loaded;
+}
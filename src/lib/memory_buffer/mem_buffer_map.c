@@ -0,0 +1,124 @@
+/*******************************************************************************
+ * Copyright (C) 2023 by Salvador Z                                            *
+ *                                                                             *
+ * This file is part of ELSU                                                   *
+ *                                                                             *
+ *   Permission is hereby granted, free of charge, to any person obtaining a   *
+ *   copy of this software and associated documentation files (the Software)   *
+ *   to deal in the Software without restriction including without limitation  *
+ *   the rights to use, copy, modify, merge, publish, distribute, sublicense,  *
+ *   and/or sell copies ot the Software, and to permit persons to whom the     *
+ *   Software is furnished to do so, subject to the following conditions:      *
+ *                                                                             *
+ *   The above copyright notice and this permission notice shall be included   *
+ *   in all copies or substantial portions of the Software.                    *
+ *                                                                             *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS   *
+ *   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARANTIES OF MERCHANTABILITY *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL   *
+ *   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR      *
+ *   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,     *
+ *   ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE        *
+ *   OR OTHER DEALINGS IN THE SOFTWARE.                                        *
+ ******************************************************************************/
+
+/**
+ * @file mem_buffer_map.c
+ * @author Salvador Z
+ * @date 17 Oct 2026
+ * @brief File for mapping a file into memory as a read-only view
+ *
+ * Regular files are mapped with `mmap` so a load does not copy the contents
+ * into a private buffer, the pages are faulted in from the page cache on
+ * demand. Anything that can't be mapped (pipes, FIFOs, character devices)
+ * goes through the `read_from_file` path.
+ *
+ * @see https://linux.die.net/man/2/mmap
+ * @see https://linux.die.net/man/2/madvise
+ */
+
+#include "memory_buffer.h"
+
+#include <errno.h>
+#include <fcntl.h> /*open*/
+#include <stdio.h> /*streams*/
+#include <string.h> /*strerror, memset*/
+#include <sys/mman.h> /*mmap, madvise*/
+#include <sys/stat.h> /*stat, S_ISREG*/
+#include <sys/types.h>
+#include <unistd.h> /*close*/
+
+/**
+ * Maps @param length bytes (whole file when 0) of the regular file opened as
+ * @param fd into @param view
+ */
+static bool map_regular_file(int fd, const char *filename, size_t length,
+                             mem_buff_view_t *view) {
+  bool success = false;
+  struct stat file_stat;
+
+  if (-1 == fstat(fd, &file_stat)) {
+    printf("Error %d (%s) on fstat %s\n", errno, strerror(errno), filename);
+  } else {
+    const size_t file_size = (size_t)file_stat.st_size;
+    if ((0 == length) || (length > file_size))
+      length = file_size;
+
+    if (0 == length) { /* Nothing to map, an empty view is still valid */
+      success = true;
+    } else {
+      void *addr = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (MAP_FAILED == addr) {
+        printf("Error %d (%s) mapping %s\n", errno, strerror(errno), filename);
+      } else {
+        /* Hints only, the mapping is usable even if the kernel refuses them */
+        madvise(addr, length, MADV_SEQUENTIAL);
+        madvise(addr, length, MADV_WILLNEED);
+        view->data = (const char *)addr;
+        view->length = length;
+        view->map_length = length;
+        success = true;
+      }
+    }
+  }
+  return success;
+}
+
+bool map_from_file(const char *filename, const size_t length, const bool block,
+                   mem_buff_view_t *view) {
+  bool success = false;
+  struct stat file_stat;
+
+  memset(view, 0, sizeof(*view));
+
+  if ((0 == stat(filename, &file_stat)) && S_ISREG(file_stat.st_mode)) {
+    int fd = open(filename, O_RDONLY);
+    if (-1 == fd) {
+      printf("Error %d (%s) opening %s\n", errno, strerror(errno), filename);
+    } else {
+      success = map_regular_file(fd, filename, length, view);
+      /* The mapping keeps its own reference to the file */
+      close(fd);
+    }
+  } else if (0 == length) {
+    printf("A length is required to read %s, it can't be mapped\n", filename);
+  } else { /* Pipes, FIFOs or a file to be created in blocking mode */
+    char *buf = read_from_file(filename, length, block);
+    if (NULL != buf) {
+      view->data = buf;
+      view->length = length;
+      success = true;
+    }
+  }
+  return success;
+}
+
+void release_mapped_file(mem_buff_view_t *view) {
+  if (NULL != view->data) {
+    if (0 != view->map_length)
+      munmap((void *)view->data, view->map_length);
+    else
+      free((void *)view->data);
+  }
+  memset(view, 0, sizeof(*view));
+}
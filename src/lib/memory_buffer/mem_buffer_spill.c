@@ -0,0 +1,174 @@
+/*******************************************************************************
+ * Copyright (C) 2023 by Salvador Z                                            *
+ *                                                                             *
+ * This file is part of ELSU                                                   *
+ *                                                                             *
+ *   Permission is hereby granted, free of charge, to any person obtaining a   *
+ *   copy of this software and associated documentation files (the Software)   *
+ *   to deal in the Software without restriction including without limitation  *
+ *   the rights to use, copy, modify, merge, publish, distribute, sublicense,  *
+ *   and/or sell copies ot the Software, and to permit persons to whom the     *
+ *   Software is furnished to do so, subject to the following conditions:      *
+ *                                                                             *
+ *   The above copyright notice and this permission notice shall be included   *
+ *   in all copies or substantial portions of the Software.                    *
+ *                                                                             *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS   *
+ *   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARANTIES OF MERCHANTABILITY *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL   *
+ *   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR      *
+ *   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,     *
+ *   ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE        *
+ *   OR OTHER DEALINGS IN THE SOFTWARE.                                        *
+ ******************************************************************************/
+
+/**
+ * @file mem_buffer_spill.c
+ * @author Salvador Z
+ * @date 17 Oct 2026
+ * @brief File for spilling many memory buffers into one temporary file
+ *
+ * Unlike `write_tmp_mem_buff` (one `mkstemp` + `unlink` per buffer) the store
+ * opens a single anonymous file and appends every buffer as a record with
+ * the same layout: the `size_t` length followed by the data. The offset of
+ * the record is the handle used to read it back with `pread`.
+ *
+ * @see https://man7.org/linux/man-pages/man2/open.2.html (O_TMPFILE)
+ * @see https://linux.die.net/man/2/pwritev
+ */
+
+#define _GNU_SOURCE /*O_TMPFILE*/
+#include "memory_buffer.h"
+#include "mem_buffer_io.h"
+
+#include <errno.h>
+#include <fcntl.h> /*open, O_TMPFILE*/
+#include <limits.h> /*PATH_MAX*/
+#include <stdio.h> /*streams, snprintf*/
+#include <string.h> /*strerror*/
+#include <sys/stat.h> /*S_IRUSR*/
+#include <sys/uio.h> /*struct iovec*/
+#include <unistd.h> /*ftruncate, unlink, close*/
+
+spill_store_t *spill_store_open(const char *dir) {
+  spill_store_t *store;
+
+  if (NULL == dir)
+    dir = "/tmp";
+
+  /* Anonymous from the start, there is no name to unlink */
+  int fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, S_IRUSR | S_IWUSR);
+  if (-1 == fd) { /* Filesystem without O_TMPFILE support */
+    char tmp_fileName[PATH_MAX];
+    snprintf(tmp_fileName, sizeof(tmp_fileName), "%s/spill_store.XXXXXX", dir);
+    fd = mkostemp(tmp_fileName, O_CLOEXEC);
+    if (-1 != fd)
+      unlink(tmp_fileName);
+  }
+
+  if (-1 == fd) {
+    fprintf(stderr, "Could not create the spill store in %s: %s\n", dir,
+            strerror(errno));
+    return NULL;
+  }
+  store = (spill_store_t *)malloc(sizeof(spill_store_t));
+  if (NULL == store) {
+    fprintf(stderr, "Could not allocate the spill store\n");
+    close(fd);
+    return NULL;
+  }
+  store->fd = fd;
+  atomic_init(&store->tail, 0);
+  return store;
+}
+
+spill_handle spill_store_write(spill_store_t *store, const char *buffer,
+                               size_t length) {
+  struct iovec iov[2] = {
+      {.iov_base = &length, .iov_len = sizeof(length)},
+      {.iov_base = (void *)buffer, .iov_len = length},
+  };
+  /* Reserve the room of the record, the write itself needs no lock */
+  off_t offset = atomic_fetch_add(&store->tail,
+                                  (off_t)(sizeof(length) + length));
+
+  if (-1 == mem_io_pwritev_full(store->fd, iov, 2, offset)) {
+    fprintf(stderr, "Error while spilling the buffer: %s\n", strerror(errno));
+    offset = -1;
+  }
+  return offset;
+}
+
+bool spill_store_write_batch(spill_store_t *store, const mem_buff_t *bufs,
+                             size_t count, spill_handle *handles) {
+  bool success = false;
+  off_t total = 0;
+  struct iovec *iov = mem_io_records_iov(bufs, count);
+
+  if (NULL == iov) {
+    fprintf(stderr, "Could not allocate the batch of %zu records\n", count);
+  } else {
+    for (size_t i = 0; i < count; i++)
+      total += (off_t)(sizeof(bufs[i].length) + bufs[i].length);
+
+    /* One reservation for the whole batch, records stay consecutive */
+    off_t offset = atomic_fetch_add(&store->tail, total);
+    for (size_t i = 0; i < count; i++) {
+      handles[i] = offset;
+      offset += (off_t)(sizeof(bufs[i].length) + bufs[i].length);
+    }
+
+    success = (0 == count) ||
+              (0 == mem_io_pwritev_full(store->fd, iov, (int)(2 * count),
+                                        handles[0]));
+    if (!success)
+      fprintf(stderr, "Error while spilling the batch: %s\n",
+              strerror(errno));
+    free(iov);
+  }
+  return success;
+}
+
+char *spill_store_read(spill_store_t *store, spill_handle handle,
+                       size_t *length) {
+  char *buffer = NULL;
+  ssize_t rd_bytes;
+
+  rd_bytes = mem_io_pread_full(store->fd, length, sizeof(*length), handle);
+  if ((ssize_t)sizeof(*length) != rd_bytes) {
+    fprintf(stderr, "Invalid spill handle %ld\n", (long)handle);
+  } else {
+    buffer = (char *)malloc(*length);
+    if (NULL == buffer) {
+      fprintf(stderr, "Could not allocate %zu bytes for the record\n",
+              *length);
+    } else {
+      rd_bytes = mem_io_pread_full(store->fd, buffer, *length,
+                                   handle + (off_t)sizeof(*length));
+      if (rd_bytes != (ssize_t)*length) {
+        fprintf(stderr, "Error while reading the record: %s\n",
+                (-1 == rd_bytes) ? strerror(errno) : "truncated");
+        free(buffer);
+        buffer = NULL;
+      }
+    }
+  }
+  return buffer;
+}
+
+bool spill_store_reset(spill_store_t *store) {
+  bool success = (0 == ftruncate(store->fd, 0));
+  if (success)
+    atomic_store(&store->tail, 0);
+  else
+    fprintf(stderr, "Could not reset the spill store: %s\n", strerror(errno));
+  return success;
+}
+
+void spill_store_close(spill_store_t *store) {
+  if (NULL == store)
+    return;
+  if (-1 != store->fd)
+    close(store->fd);
+  free(store);
+}
@@ -0,0 +1,225 @@
+/*******************************************************************************
+ * Copyright (C) 2023 by Salvador Z                                            *
+ *                                                                             *
+ * This file is part of ELSU                                                   *
+ *                                                                             *
+ *   Permission is hereby granted, free of charge, to any person obtaining a   *
+ *   copy of this software and associated documentation files (the Software)   *
+ *   to deal in the Software without restriction including without limitation  *
+ *   the rights to use, copy, modify, merge, publish, distribute, sublicense,  *
+ *   and/or sell copies ot the Software, and to permit persons to whom the     *
+ *   Software is furnished to do so, subject to the following conditions:      *
+ *                                                                             *
+ *   The above copyright notice and this permission notice shall be included   *
+ *   in all copies or substantial portions of the Software.                    *
+ *                                                                             *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS   *
+ *   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARANTIES OF MERCHANTABILITY *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL   *
+ *   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR      *
+ *   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,     *
+ *   ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE        *
+ *   OR OTHER DEALINGS IN THE SOFTWARE.                                        *
+ ******************************************************************************/
+
+/**
+ * @file mem_buffer_stream.c
+ * @author Salvador Z
+ * @date 17 Oct 2026
+ * @brief File for streaming a file in chunks through a ring of buffers
+ *
+ * A reader thread fills the free slots of the ring while the calling thread
+ * hands the filled ones to the consumer callback, so the data can be
+ * processed while the rest of the file is still being read.
+ *
+ * @see https://linux.die.net/man/2/read
+ * @see https://linux.die.net/man/3/pthread_cond_wait
+ */
+
+#include "memory_buffer.h"
+#include "mem_buffer_io.h"
+
+#include <errno.h>
+#include <fcntl.h> /*open*/
+#include <pthread.h>
+#include <stdio.h> /*streams*/
+#include <string.h> /*strerror*/
+#include <unistd.h> /*close*/
+
+/**
+ * The state shared between the reader thread and the consumer
+ */
+struct chunk_ring {
+  int fd;
+  char **bufs;
+  size_t *lengths; /* bytes held by each slot */
+  size_t nbufs;
+  size_t chunk_size;
+  size_t head;   /* next slot to be filled by the reader */
+  size_t tail;   /* next slot to be consumed */
+  size_t filled; /* slots waiting for the consumer */
+  bool done;     /* the reader reached EOF or failed */
+  bool stop;     /* the consumer asked to stop */
+  int error;     /* errno of the failed read, 0 otherwise */
+  pthread_mutex_t mutex;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+};
+
+/**
+ * Reader thread entry point, @param arg is the struct chunk_ring
+ */
+static void *chunk_reader(void *arg) {
+  struct chunk_ring *ring = (struct chunk_ring *)arg;
+  bool done = false;
+
+  while (!done) {
+    size_t slot;
+    pthread_mutex_lock(&ring->mutex);
+    while ((ring->filled == ring->nbufs) && !ring->stop)
+      pthread_cond_wait(&ring->not_full, &ring->mutex);
+    done = ring->stop;
+    slot = ring->head % ring->nbufs;
+    pthread_mutex_unlock(&ring->mutex);
+    if (done)
+      break;
+
+    /* The slot is owned by the reader until it is published */
+    ssize_t rd_bytes =
+        mem_io_read_full(ring->fd, ring->bufs[slot], ring->chunk_size);
+
+    pthread_mutex_lock(&ring->mutex);
+    if (-1 == rd_bytes) {
+      ring->error = errno;
+      done = true;
+    } else {
+      if (0 < rd_bytes) {
+        ring->lengths[slot] = (size_t)rd_bytes;
+        ring->head++;
+        ring->filled++;
+      }
+      /* A chunk shorter than requested only happens at EOF */
+      done = ((size_t)rd_bytes < ring->chunk_size);
+    }
+    ring->done = done;
+    pthread_cond_signal(&ring->not_empty);
+    pthread_mutex_unlock(&ring->mutex);
+  }
+  return NULL;
+}
+
+/**
+ * Single buffer case: read a chunk then consume it, no thread needed
+ */
+static ssize_t stream_in_turns(int fd, char *buf, size_t chunk_size,
+                               mem_chunk_callback callback, void *ctx) {
+  ssize_t total = 0;
+  ssize_t rd_bytes;
+
+  do {
+    rd_bytes = mem_io_read_full(fd, buf, chunk_size);
+    if (-1 == rd_bytes) {
+      printf("Error returned from read(), errno is %d (%s)\n", errno,
+             strerror(errno));
+      return -1;
+    }
+    if (0 < rd_bytes) {
+      total += rd_bytes;
+      if (!callback(buf, (size_t)rd_bytes, ctx))
+        break;
+    }
+  } while ((size_t)rd_bytes == chunk_size);
+
+  return total;
+}
+
+ssize_t stream_from_fd(int fd, char **ring, size_t nbufs, size_t chunk_size,
+                       mem_chunk_callback callback, void *ctx) {
+  struct chunk_ring state;
+  pthread_t reader;
+  ssize_t total = 0;
+  int rc;
+
+  if ((NULL == ring) || (0 == nbufs) || (0 == chunk_size) ||
+      (NULL == callback)) {
+    printf("Invalid ring of buffers for streaming\n");
+    return -1;
+  }
+  if (1 == nbufs)
+    return stream_in_turns(fd, ring[0], chunk_size, callback, ctx);
+
+  memset(&state, 0, sizeof(state));
+  state.fd = fd;
+  state.bufs = ring;
+  state.nbufs = nbufs;
+  state.chunk_size = chunk_size;
+  state.lengths = (size_t *)calloc(nbufs, sizeof(size_t));
+  if (NULL == state.lengths) {
+    printf("Memory allocation for the chunk ring failed\n");
+    return -1;
+  }
+  pthread_mutex_init(&state.mutex, NULL);
+  pthread_cond_init(&state.not_empty, NULL);
+  pthread_cond_init(&state.not_full, NULL);
+
+  rc = pthread_create(&reader, NULL, chunk_reader, &state);
+  if (0 != rc) {
+    printf("pthread_create failed with error %d creating the reader\n", rc);
+    total = -1;
+  } else {
+    for (;;) {
+      size_t slot, length;
+      pthread_mutex_lock(&state.mutex);
+      while ((0 == state.filled) && !state.done)
+        pthread_cond_wait(&state.not_empty, &state.mutex);
+      if (0 == state.filled) { /* drained and the reader is done */
+        pthread_mutex_unlock(&state.mutex);
+        break;
+      }
+      slot = state.tail % nbufs;
+      length = state.lengths[slot];
+      pthread_mutex_unlock(&state.mutex);
+
+      bool keep_going = callback(ring[slot], length, ctx);
+      total += (ssize_t)length;
+
+      pthread_mutex_lock(&state.mutex);
+      state.tail++;
+      state.filled--;
+      state.stop = !keep_going;
+      pthread_cond_signal(&state.not_full);
+      pthread_mutex_unlock(&state.mutex);
+      if (!keep_going)
+        break;
+    }
+    pthread_join(reader, NULL);
+    if (0 != state.error) {
+      printf("Error returned from read(), errno is %d (%s)\n", state.error,
+             strerror(state.error));
+      total = -1;
+    }
+  }
+
+  pthread_cond_destroy(&state.not_full);
+  pthread_cond_destroy(&state.not_empty);
+  pthread_mutex_destroy(&state.mutex);
+  free(state.lengths);
+  return total;
+}
+
+ssize_t stream_from_file(const char *filename, char **ring, size_t nbufs,
+                         size_t chunk_size, mem_chunk_callback callback,
+                         void *ctx) {
+  ssize_t total = -1;
+  int fd = open(filename, O_RDONLY);
+
+  if (-1 == fd) {
+    printf("Error %d (%s) opening %s\n", errno, strerror(errno), filename);
+  } else {
+    /* Let the kernel read ahead aggressively, it's a no-op for FIFOs */
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    total = stream_from_fd(fd, ring, nbufs, chunk_size, callback, ctx);
+    close(fd);
+  }
+  return total;
+}
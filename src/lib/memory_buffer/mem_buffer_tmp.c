@@ -35,15 +35,21 @@
  */
 
 #include "memory_buffer.h"
+#include "mem_buffer_io.h"
+#include "mem_codec.h"
 
 #include <assert.h>
 #include <errno.h>
 #include <stdio.h> /*streams, SEEK_SET*/
 #include <string.h> /*strerror*/
+#include <sys/uio.h> /*struct iovec*/
 #include <unistd.h> /*read, write,lseek,unlink*/
 
 
-tmp_file_handle write_tmp_mem_buff(char *buffer, size_t length) {
+/**
+ * Creates the unique temporary file, already unlinked
+ */
+static int create_tmp_file(void) {
   /* The XXXXXX will be replaced with characters that make the filename unique.  */
   char tmp_fileName[] = "/tmp/tmp_file.XXXXXX";
 
@@ -52,23 +58,204 @@ tmp_file_handle write_tmp_mem_buff(char *buffer, size_t length) {
   if (-1 != fd) { /* Unlink the file immediately, it will be removed
      when the file descriptor is closed.  */
     unlink(tmp_fileName);
-
-    /* Write the number of bytes to the file first.  */
-    write(fd, &length, sizeof(length));
-    /* Now write the data itself.  */
-    write(fd, buffer, length);
   } else {
     fprintf(stderr, "Could not create a unique temporary filename: %s\n",
               strerror(errno));
     assert (fd > 0);
   }
+  return fd;
+}
+
+
+tmp_file_handle write_tmp_mem_batch(const mem_buff_t *bufs, size_t count) {
+  int fd = create_tmp_file();
+
+  if (-1 != fd) {
+    /* The number of bytes of each buffer goes first, then the data itself,
+       all of them on the same vectored write. */
+    struct iovec *iov = mem_io_records_iov(bufs, count);
+    if ((NULL == iov) ||
+        (-1 == mem_io_pwritev_full(fd, iov, (int)(2 * count), 0))) {
+      fprintf(stderr, "Error while writing the buffers: %s\n",
+              strerror(errno));
+      close(fd);
+      fd = -1;
+    }
+    free(iov);
+  }
 
   /* Use the file descriptor as the handle for the temporary file. */
   return fd;
 }
 
 
+tmp_file_handle write_tmp_mem_buff(char *buffer, size_t length) {
+  /* A single buffer is a batch of one */
+  mem_buff_t buf = {.buffer = buffer, .length = length};
+  return write_tmp_mem_batch(&buf, 1);
+}
+
+
+tmp_file_handle write_tmp_mem_buff_codec(char *buffer, size_t length,
+                                         mem_codec_t codec) {
+  uint8_t *packed = NULL;
+  size_t packed_len = 0;
+
+  if (MEM_CODEC_LZ == codec) {
+    const size_t bound = mem_lz_bound(length);
+    packed = (uint8_t *)malloc(bound);
+    if (NULL != packed)
+      packed_len =
+          mem_lz_compress((const uint8_t *)buffer, length, packed, bound);
+  }
+  if ((0 == packed_len) || (packed_len >= length)) {
+    /* Nothing gained, keep the raw layout */
+    free(packed);
+    return write_tmp_mem_buff(buffer, length);
+  }
+
+  int fd = create_tmp_file();
+  if (-1 != fd) {
+    uint64_t magic = MEM_RECORD_EXT_MAGIC;
+    struct mem_record_ext ext = {
+        .codec = (uint32_t)codec,
+        .checksum = mem_crc32(buffer, length),
+        .raw_length = length,
+        .stored_length = packed_len,
+    };
+    struct iovec iov[3] = {
+        {.iov_base = &magic, .iov_len = sizeof(magic)},
+        {.iov_base = &ext, .iov_len = sizeof(ext)},
+        {.iov_base = packed, .iov_len = packed_len},
+    };
+    if (-1 == mem_io_pwritev_full(fd, iov, 3, 0)) {
+      fprintf(stderr, "Error while writing the buffer: %s\n",
+              strerror(errno));
+      close(fd);
+      fd = -1;
+    }
+  }
+  free(packed);
+  return fd;
+}
+
+
+/**
+ * Reads the rest of a compressed record from @param fd, positioned after
+ * its magic word, and decodes it into a buffer of @param pool
+ */
+static char *read_ext_record(int fd, size_t *length, mem_pool_t *pool) {
+  struct mem_record_ext ext;
+  char *buffer = NULL;
+  uint8_t *packed = NULL;
+
+  if ((ssize_t)sizeof(ext) != mem_io_read_full(fd, &ext, sizeof(ext))) {
+    fprintf(stderr, "Truncated compressed record header\n");
+  } else if (MEM_CODEC_LZ != ext.codec) {
+    fprintf(stderr, "Unknown codec %u on the record\n", ext.codec);
+  } else if ((NULL == (packed = (uint8_t *)malloc(ext.stored_length))) ||
+             (NULL == (buffer = (char *)mem_pool_alloc(pool,
+                                                        ext.raw_length)))) {
+    fprintf(stderr, "Could not allocate the compressed record\n");
+  } else if (((ssize_t)ext.stored_length !=
+              mem_io_read_full(fd, packed, ext.stored_length)) ||
+             !mem_lz_decompress(packed, ext.stored_length, (uint8_t *)buffer,
+                                ext.raw_length) ||
+             (ext.checksum != mem_crc32(buffer, ext.raw_length))) {
+    fprintf(stderr, "Corrupted compressed record\n");
+    mem_pool_free(pool, buffer);
+    buffer = NULL;
+  } else {
+    *length = ext.raw_length;
+  }
+  free(packed);
+  return buffer;
+}
+
+
+size_t read_tmp_mem_batch(tmp_file_handle tmp_file, mem_buff_t *bufs,
+                          size_t count) {
+  size_t nread = 0;
+
+  if (-1 != tmp_file) {
+    /* converting the file_handle back to a file descriptor */
+    int fd = (int)tmp_file;
+    size_t length = 0;
+    off_t offset = sizeof(length);
+    /* Only the first size is read on its own */
+    bool more = (0 < count) &&
+                ((ssize_t)sizeof(length) ==
+                 mem_io_pread_full(fd, &length, sizeof(length), 0));
+
+    while (more) {
+      size_t next_length = 0;
+      if (MEM_RECORD_EXT_MAGIC == length) {
+        /* Not a size but the mark of a compressed record, decoded the same
+           way read_tmp_mem_buff does */
+        char *buffer = NULL;
+        if (offset == lseek(fd, offset, SEEK_SET))
+          buffer = read_ext_record(fd, &bufs[nread].length, NULL);
+        if (NULL == buffer)
+          break;
+        bufs[nread].buffer = buffer;
+        nread++;
+
+        offset = lseek(fd, 0, SEEK_CUR);
+        more = (nread < count) &&
+               ((ssize_t)sizeof(next_length) ==
+                mem_io_pread_full(fd, &next_length, sizeof(next_length),
+                                  offset));
+        offset += (off_t)sizeof(next_length);
+        length = next_length;
+        continue;
+      }
+      char *buffer = (char *)malloc(length);
+      if (NULL == buffer) {
+        fprintf(stderr, "Could not allocate %zu bytes for the buffer\n",
+                length);
+        break;
+      }
+      /* The data of this buffer and the size of the next one */
+      struct iovec iov[2] = {
+          {.iov_base = buffer, .iov_len = length},
+          {.iov_base = &next_length, .iov_len = sizeof(next_length)},
+      };
+      const int iovcnt = (nread + 1 < count) ? 2 : 1;
+      ssize_t rd_bytes = mem_io_preadv_full(fd, iov, iovcnt, offset);
+
+      if ((-1 == rd_bytes) || (rd_bytes < (ssize_t)length)) {
+        fprintf(stderr, "Error while reading the buffer: %s\n",
+                (-1 == rd_bytes) ? strerror(errno) : "truncated");
+        free(buffer);
+        break;
+      }
+      bufs[nread].buffer = buffer;
+      bufs[nread].length = length;
+      nread++;
+
+      offset += rd_bytes;
+      more = (2 == iovcnt) &&
+             (rd_bytes == (ssize_t)(length + sizeof(next_length)));
+      length = next_length;
+    }
+
+    /* will cause the temporary file to go away.  */
+    close(fd);
+  } else {
+    assert(tmp_file > 0); // assert if fails the condition
+  }
+
+  return nread;
+}
+
+
 char* read_tmp_mem_buff(tmp_file_handle tmp_file, size_t *length) {
+  return read_tmp_mem_buff_pool(tmp_file, length, NULL);
+}
+
+
+char *read_tmp_mem_buff_pool(tmp_file_handle tmp_file, size_t *length,
+                             mem_pool_t *pool) {
   char *buffer = NULL;
 
   if (-1 != tmp_file) {
@@ -77,33 +264,23 @@ char* read_tmp_mem_buff(tmp_file_handle tmp_file, size_t *length) {
     /* Going to the beginning of the file.  */
     lseek(fd, 0, SEEK_SET);
     /* Read the size of the buffered data in the tmp file. */
-    ssize_t rd_bytes = read(fd, length, sizeof(*length));
-    if (sizeof(*length) == rd_bytes)
+    ssize_t rd_bytes = mem_io_read_full(fd, length, sizeof(*length));
+    if ((ssize_t)sizeof(*length) != rd_bytes) {
+      fprintf(stderr, "Error while reading the buffer size: %s\n",
+              (-1 == rd_bytes) ? strerror(errno) : "truncated");
+    } else if (MEM_RECORD_EXT_MAGIC == *length) {
+      /* Not a size but the mark of a compressed record */
+      buffer = read_ext_record(fd, length, pool);
+    } else if (NULL == (buffer = (char *)mem_pool_alloc(pool, *length))) {
       /* Allocate a buffer and fetch the data from tmp */
-      buffer = (char *)malloc(*length);
-
-    rd_bytes = read(fd, buffer, *length);
-
-    if (rd_bytes != (ssize_t)*length) {
-      int error = errno;
-      // assert(-1 == rd_bytes);
-      switch (error) {
-      case EAGAIN: /*the FD has been marked nonblocking and the read would block*/
-      case EBADF:  /*fd is not a valid FD or is not open for reading. */
-      case EINVAL: /*fd is attached to an object which is unsuitable for reading*/
-      case EINTR: /*The call was interrupted by a signal before any data was read*/
-        fprintf(stderr, "Error while reading the buffer: %s\n",
-                strerror(errno));
-        break;
-      case EIO:
-        exit(-1); /*Handling a System Error*/
-      case EISDIR: /*Fd refers to a directory.*/
-      case EFAULT: /*buf is outside your accessible address space. */
-      default:     /* Some other error code, most likely a bug */
-        fprintf(stderr, "Aborting... %s\n",
-                strerror(errno));
-        abort(); /*Handling a bug*/
-      };
+      fprintf(stderr, "Could not allocate %zu bytes for the buffer\n",
+              *length);
+    } else if ((ssize_t)*length !=
+               (rd_bytes = mem_io_read_full(fd, buffer, *length))) {
+      fprintf(stderr, "Error while reading the buffer: %s\n",
+              (-1 == rd_bytes) ? strerror(errno) : "truncated");
+      mem_pool_free(pool, buffer);
+      buffer = NULL;
     }
       
     /* will cause the temporary file to go away.  */
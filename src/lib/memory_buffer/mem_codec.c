@@ -0,0 +1,296 @@
+/*******************************************************************************
+ * Copyright (C) 2023 by Salvador Z                                            *
+ *                                                                             *
+ * This file is part of ELSU                                                   *
+ *                                                                             *
+ *   Permission is hereby granted, free of charge, to any person obtaining a   *
+ *   copy of this software and associated documentation files (the Software)   *
+ *   to deal in the Software without restriction including without limitation  *
+ *   the rights to use, copy, modify, merge, publish, distribute, sublicense,  *
+ *   and/or sell copies ot the Software, and to permit persons to whom the     *
+ *   Software is furnished to do so, subject to the following conditions:      *
+ *                                                                             *
+ *   The above copyright notice and this permission notice shall be included   *
+ *   in all copies or substantial portions of the Software.                    *
+ *                                                                             *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS   *
+ *   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARANTIES OF MERCHANTABILITY *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL   *
+ *   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR      *
+ *   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,     *
+ *   ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE        *
+ *   OR OTHER DEALINGS IN THE SOFTWARE.                                        *
+ ******************************************************************************/
+
+/**
+ * @file mem_codec.c
+ * @author Salvador Z
+ * @date 17 Oct 2026
+ * @brief File for the codec of the compressed spill records
+ *
+ * The format follows the LZ4 block layout: a sequence is a token (4 bits of
+ * literal length, 4 bits of match length - 4), optional 255-continued
+ * length bytes, the literals, a 16 bits little endian offset and optional
+ * match length bytes. The last sequence has literals only. Matches are
+ * found with a single-probe hash table of 4 bytes prefixes, which keeps the
+ * compressor at memory bandwidth speeds rather than chasing the best ratio:
+ * matches are extended a word at a time, and the search skips further ahead
+ * the longer it goes without finding one. The decoder copies matches a word
+ * at a time too, unless they overlap what they produce. The checksum is a
+ * crc32 computed 8 bytes at a time (slicing-by-8).
+ *
+ * @see https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+ */
+
+#include "mem_codec.h"
+
+#include <pthread.h> /*pthread_once*/
+#include <string.h> /*memcpy, memset*/
+
+#define LZ_MIN_MATCH 4U
+#define LZ_MAX_OFFSET 65535U
+#define LZ_HASH_BITS 14U
+/* The search step grows by a byte every 1 << LZ_SKIP_TRIGGER misses */
+#define LZ_SKIP_TRIGGER 6U
+/* Room the decoder keeps to copy whole words past the end of a copy */
+#define LZ_WILD_COPY 8U
+
+#define LZ_LITTLE_ENDIAN (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+
+static inline uint32_t read32(const uint8_t *ptr) {
+  uint32_t value;
+  memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+static inline uint64_t read64(const uint8_t *ptr) {
+  uint64_t value;
+  memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+/**
+ * Length of the common prefix of @param left and @param right, up to
+ * @param limit bytes
+ */
+static inline size_t common_length(const uint8_t *left, const uint8_t *right,
+                                   size_t limit) {
+  size_t length = 0;
+
+#if LZ_LITTLE_ENDIAN
+  while (length + sizeof(uint64_t) <= limit) {
+    const uint64_t diff = read64(left + length) ^ read64(right + length);
+    if (0 != diff)
+      return length + ((size_t)__builtin_ctzll(diff) >> 3);
+    length += sizeof(uint64_t);
+  }
+#endif
+  while ((length < limit) && (left[length] == right[length]))
+    length++;
+  return length;
+}
+
+static inline uint32_t lz_hash(uint32_t sequence) {
+  return (sequence * 2654435761U) >> (32U - LZ_HASH_BITS);
+}
+
+/**
+ * Writes the 255-continued rest of a length that didn't fit in the token
+ */
+static inline uint8_t *put_length(uint8_t *op, const uint8_t *oend,
+                                  size_t length) {
+  while (length >= 255U) {
+    if (op >= oend)
+      return NULL;
+    *op++ = 255U;
+    length -= 255U;
+  }
+  if (op >= oend)
+    return NULL;
+  *op++ = (uint8_t)length;
+  return op;
+}
+
+/**
+ * Emits the literals [@param literals, +@param nlit) followed by a match of
+ * @param match_len bytes at @param offset (0 for the last sequence)
+ */
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *oend,
+                             const uint8_t *literals, size_t nlit,
+                             size_t offset, size_t match_len) {
+  const size_t mcode = (0 == offset) ? 0 : match_len - LZ_MIN_MATCH;
+  uint8_t *token;
+
+  if (op >= oend)
+    return NULL;
+  token = op++;
+  *token = (uint8_t)(((nlit < 15U) ? nlit : 15U) << 4);
+  *token |= (uint8_t)((mcode < 15U) ? mcode : 15U);
+  if ((nlit >= 15U) && (NULL == (op = put_length(op, oend, nlit - 15U))))
+    return NULL;
+  if ((size_t)(oend - op) < nlit)
+    return NULL;
+  memcpy(op, literals, nlit);
+  op += nlit;
+  if (0 != offset) {
+    if (oend - op < 2)
+      return NULL;
+    *op++ = (uint8_t)(offset & 0xFFU);
+    *op++ = (uint8_t)(offset >> 8);
+    if ((mcode >= 15U) && (NULL == (op = put_length(op, oend, mcode - 15U))))
+      return NULL;
+  }
+  return op;
+}
+
+size_t mem_lz_bound(size_t length) { return length + length / 255U + 16U; }
+
+size_t mem_lz_compress(const uint8_t *src, size_t length, uint8_t *dst,
+                       size_t capacity) {
+  /* Positions + 1, so 0 means an empty entry */
+  uint32_t table[1U << LZ_HASH_BITS];
+  const uint8_t *const oend = dst + capacity;
+  uint8_t *op = dst;
+  size_t anchor = 0;
+  size_t pos = 0;
+  size_t misses = 0;
+
+  memset(table, 0, sizeof(table));
+  while ((NULL != op) && (pos + LZ_MIN_MATCH <= length)) {
+    const uint32_t sequence = read32(src + pos);
+    const uint32_t hash = lz_hash(sequence);
+    const size_t candidate = table[hash];
+    table[hash] = (uint32_t)(pos + 1);
+
+    if ((0 != candidate) && (pos - (candidate - 1) <= LZ_MAX_OFFSET) &&
+        (read32(src + candidate - 1) == sequence)) {
+      const size_t match = candidate - 1;
+      const size_t match_len =
+          LZ_MIN_MATCH + common_length(src + match + LZ_MIN_MATCH,
+                                       src + pos + LZ_MIN_MATCH,
+                                       length - pos - LZ_MIN_MATCH);
+      op = put_sequence(op, oend, src + anchor, pos - anchor, pos - match,
+                        match_len);
+      pos += match_len;
+      anchor = pos;
+      misses = 0;
+    } else {
+      /* Data that doesn't compress is crossed faster */
+      pos += 1U + (misses++ >> LZ_SKIP_TRIGGER);
+    }
+  }
+  if (NULL != op)
+    op = put_sequence(op, oend, src + anchor, length - anchor, 0, 0);
+  return (NULL == op) ? 0 : (size_t)(op - dst);
+}
+
+/**
+ * Reads the 255-continued rest of a length from the token
+ */
+static inline bool get_length(const uint8_t **ip, const uint8_t *iend,
+                              size_t *length) {
+  uint8_t byte;
+  do {
+    if (*ip >= iend)
+      return false;
+    byte = *(*ip)++;
+    *length += byte;
+  } while (255U == byte);
+  return true;
+}
+
+bool mem_lz_decompress(const uint8_t *src, size_t length, uint8_t *dst,
+                       size_t raw_length) {
+  const uint8_t *ip = src;
+  const uint8_t *const iend = src + length;
+  uint8_t *op = dst;
+  uint8_t *const oend = dst + raw_length;
+
+  while (ip < iend) {
+    const uint8_t token = *ip++;
+    size_t nlit = token >> 4;
+    if ((15U == nlit) && !get_length(&ip, iend, &nlit))
+      return false;
+    if (((size_t)(iend - ip) < nlit) || ((size_t)(oend - op) < nlit))
+      return false;
+    if ((nlit <= 2U * LZ_WILD_COPY) &&
+        ((size_t)(iend - ip) >= 2U * LZ_WILD_COPY) &&
+        ((size_t)(oend - op) >= 2U * LZ_WILD_COPY))
+      memcpy(op, ip, 2U * LZ_WILD_COPY); /* short runs, a fixed size copy */
+    else
+      memcpy(op, ip, nlit);
+    ip += nlit;
+    op += nlit;
+    if (ip == iend)
+      break; /* the last sequence has no match */
+
+    if (iend - ip < 2)
+      return false;
+    const size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+    ip += 2;
+    size_t match_len = token & 0x0FU;
+    if ((15U == match_len) && !get_length(&ip, iend, &match_len))
+      return false;
+    match_len += LZ_MIN_MATCH;
+    if ((0 == offset) || ((size_t)(op - dst) < offset) ||
+        ((size_t)(oend - op) < match_len))
+      return false;
+    const uint8_t *match = op - offset;
+    uint8_t *const match_end = op + match_len;
+    if ((LZ_WILD_COPY <= offset) &&
+        ((size_t)(oend - match_end) >= 2U * LZ_WILD_COPY)) {
+      /* A word never reads what it writes, the last one may write past the
+         match into room the next sequences overwrite */
+      memcpy(op, match, LZ_WILD_COPY);
+      memcpy(op + LZ_WILD_COPY, match + LZ_WILD_COPY, LZ_WILD_COPY);
+      for (op += 2U * LZ_WILD_COPY, match += 2U * LZ_WILD_COPY;
+           op < match_end; op += LZ_WILD_COPY, match += LZ_WILD_COPY)
+        memcpy(op, match, LZ_WILD_COPY);
+      op = match_end;
+    } else {
+      /* Byte by byte, the match overlaps what it is producing */
+      while (op < match_end)
+        *op++ = *match++;
+    }
+  }
+  return (op == oend);
+}
+
+/* crc32_table[k][b]: crc of byte b followed by k zero bytes */
+static uint32_t crc32_table[8][256];
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+
+static void crc32_init(void) {
+  for (uint32_t i = 0; i < 256U; i++) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc & 1U) ? (crc >> 1) ^ 0xEDB88320U : (crc >> 1);
+    crc32_table[0][i] = crc;
+  }
+  for (uint32_t i = 0; i < 256U; i++)
+    for (int k = 1; k < 8; k++)
+      crc32_table[k][i] = (crc32_table[k - 1][i] >> 8) ^
+                          crc32_table[0][crc32_table[k - 1][i] & 0xFFU];
+}
+
+uint32_t mem_crc32(const void *data, size_t length) {
+  const uint8_t *byte = (const uint8_t *)data;
+  uint32_t crc = 0xFFFFFFFFU;
+
+  pthread_once(&crc32_once, crc32_init);
+  for (; length >= 8U; length -= 8U, byte += 8U) {
+    uint32_t low = read32(byte), high = read32(byte + 4);
+#if !LZ_LITTLE_ENDIAN
+    low = __builtin_bswap32(low);
+    high = __builtin_bswap32(high);
+#endif
+    low ^= crc;
+    crc = crc32_table[7][low & 0xFFU] ^ crc32_table[6][(low >> 8) & 0xFFU] ^
+          crc32_table[5][(low >> 16) & 0xFFU] ^ crc32_table[4][low >> 24] ^
+          crc32_table[3][high & 0xFFU] ^ crc32_table[2][(high >> 8) & 0xFFU] ^
+          crc32_table[1][(high >> 16) & 0xFFU] ^ crc32_table[0][high >> 24];
+  }
+  while (0 != length--)
+    crc = crc32_table[0][(crc ^ *byte++) & 0xFFU] ^ (crc >> 8);
+  return crc ^ 0xFFFFFFFFU;
+}
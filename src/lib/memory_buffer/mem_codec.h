@@ -0,0 +1,57 @@
+/*
+ * @mem_codec.h
+ *
+ * @version: 1.0
+ * @Author:  Salvador Z
+ * @brief:   LZ codec and checksum of the compressed spill records
+ */
+
+#ifndef MEM_CODEC_H_
+#define MEM_CODEC_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h> /*size_t*/
+
+/* First word of a record carrying a mem_record_ext header. Can't be taken
+   for the length of a raw record, no buffer is 2^63 bytes long.  */
+#define MEM_RECORD_EXT_MAGIC (((uint64_t)1 << 63) | 0x4C5A5350494C4CULL)
+
+/**
+ * The header following MEM_RECORD_EXT_MAGIC, then stored_length bytes
+ */
+struct mem_record_ext {
+  uint32_t codec;         /* mem_codec_t used on the data */
+  uint32_t checksum;      /* crc32 of the uncompressed data */
+  uint64_t raw_length;    /* bytes once decompressed */
+  uint64_t stored_length; /* bytes following the header */
+};
+
+/**
+ * @brief Worst case size of mem_lz_compress output for length bytes.
+ */
+size_t mem_lz_bound(size_t length);
+
+/**
+ * @brief Compresses src into dst with an LZ77 byte oriented format.
+ *
+ * @return size_t bytes written to dst, 0 if they don't fit in capacity
+ */
+size_t mem_lz_compress(const uint8_t *src, size_t length, uint8_t *dst,
+                       size_t capacity);
+
+/**
+ * @brief Decompresses src into exactly raw_length bytes of dst. Every
+ * length and offset is bounds checked, corrupted input is rejected.
+ *
+ * @return true if src decoded to raw_length bytes
+ */
+bool mem_lz_decompress(const uint8_t *src, size_t length, uint8_t *dst,
+                       size_t raw_length);
+
+/**
+ * @brief CRC-32 (IEEE 802.3) of length bytes of data.
+ */
+uint32_t mem_crc32(const void *data, size_t length);
+
+#endif // MEM_CODEC_H_
\ No newline at end of file
@@ -0,0 +1,400 @@
+/*******************************************************************************
+ * Copyright (C) 2023 by Salvador Z                                            *
+ *                                                                             *
+ * This file is part of ELSU                                                   *
+ *                                                                             *
+ *   Permission is hereby granted, free of charge, to any person obtaining a   *
+ *   copy of this software and associated documentation files (the Software)   *
+ *   to deal in the Software without restriction including without limitation  *
+ *   the rights to use, copy, modify, merge, publish, distribute, sublicense,  *
+ *   and/or sell copies ot the Software, and to permit persons to whom the     *
+ *   Software is furnished to do so, subject to the following conditions:      *
+ *                                                                             *
+ *   The above copyright notice and this permission notice shall be included   *
+ *   in all copies or substantial portions of the Software.                    *
+ *                                                                             *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS   *
+ *   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARANTIES OF MERCHANTABILITY *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL   *
+ *   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR      *
+ *   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,     *
+ *   ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE        *
+ *   OR OTHER DEALINGS IN THE SOFTWARE.                                        *
+ ******************************************************************************/
+
+/**
+ * @file mem_pool.c
+ * @author Salvador Z
+ * @date 17 Oct 2026
+ * @brief File for a size-classed pool of memory buffers
+ *
+ * Buffers are carved from `mmap`'d slabs in power of two classes. A freed
+ * buffer goes to a per-thread cache of its class (no lock), the cache
+ * exchanges batches with a per-class free list (one mutex per class) and
+ * only an empty free list maps a new slab. Every buffer is preceded by a
+ * cache line header telling its class, so releasing it needs no lookup.
+ *
+ * @see https://linux.die.net/man/3/pthread_getspecific
+ * @see https://man7.org/linux/man-pages/man2/madvise.2.html (MADV_HUGEPAGE)
+ */
+
+#include "memory_buffer.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h> /*streams*/
+#include <string.h> /*strerror*/
+#include <sys/mman.h> /*mmap, madvise*/
+#include <unistd.h> /*sysconf*/
+
+#define POOL_MIN_SHIFT 12U /* 4 KiB */
+#define POOL_CLASSES 15U   /* 4 KiB .. 64 MiB */
+#define POOL_HEADER 64U    /* keeps the buffers cache line aligned */
+#define POOL_SLAB_MIN (2U << 20) /* one huge page */
+#define POOL_OVERSIZE POOL_CLASSES
+#define POOL_MAGIC 0x6d706f6f6cU
+
+/**
+ * The header in front of every buffer handed out
+ */
+struct pool_block {
+  struct pool_block *next; /* link while the block is free */
+  uint64_t magic;
+  size_t length;           /* bytes mapped for an oversize block */
+  unsigned int klass;
+};
+
+/**
+ * A slab of memory obtained from the system
+ */
+struct pool_slab {
+  struct pool_slab *next;
+  void *addr;
+  size_t length;
+};
+
+/**
+ * The per-thread cache of a pool
+ */
+struct pool_tcache {
+  mem_pool_t *pool;
+  struct pool_tcache *next; /* registry of caches of the pool */
+  struct pool_block *blocks[POOL_CLASSES];
+  unsigned int count[POOL_CLASSES];
+  /* Updated by the owner only, read when merging the stats */
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t frees;
+  uint64_t oversize;
+};
+
+struct mem_pool {
+  bool hugepages;
+  pthread_key_t key;
+  pthread_mutex_t mutex[POOL_CLASSES]; /* protects free[] */
+  struct pool_block *free[POOL_CLASSES];
+  pthread_mutex_t registry_mutex;      /* protects slabs, caches, retired */
+  struct pool_slab *slabs;
+  struct pool_tcache *caches;
+  mem_pool_stats_t retired;            /* stats of exited threads */
+};
+
+static inline size_t class_size(unsigned int klass) {
+  return (size_t)1 << (POOL_MIN_SHIFT + klass);
+}
+
+/**
+ * Amount of buffers a thread may keep per class, bounded to ~4 MiB
+ */
+static inline unsigned int class_cache_limit(unsigned int klass) {
+  const size_t limit = ((size_t)4 << 20) / class_size(klass);
+  return (limit > 16U) ? 16U : (0U == limit) ? 1U : (unsigned int)limit;
+}
+
+static unsigned int length_class(size_t length) {
+  unsigned int klass = 0;
+  while ((klass < POOL_CLASSES) && (class_size(klass) < length))
+    klass++;
+  return klass;
+}
+
+static void *pool_map(mem_pool_t *pool, size_t length) {
+  void *addr = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (MAP_FAILED == addr) {
+    printf("Error %d (%s) mapping %zu bytes for the pool\n", errno,
+           strerror(errno), length);
+    return NULL;
+  }
+  if (pool->hugepages && (POOL_SLAB_MIN <= length))
+    madvise(addr, length, MADV_HUGEPAGE); /* a hint, THP may be disabled */
+  return addr;
+}
+
+static size_t round_to_pages(size_t length) {
+  const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  return (length + page - 1) & ~(page - 1);
+}
+
+/**
+ * Maps a new slab for @param klass and links its blocks in the free list.
+ * Called with the class mutex held.
+ */
+static bool pool_grow(mem_pool_t *pool, unsigned int klass) {
+  const size_t stride = POOL_HEADER + class_size(klass);
+  size_t nblocks = POOL_SLAB_MIN / stride;
+  if (0 == nblocks)
+    nblocks = 1;
+  const size_t length = round_to_pages(nblocks * stride);
+
+  struct pool_slab *slab = (struct pool_slab *)malloc(sizeof(*slab));
+  char *addr = (NULL == slab) ? NULL : (char *)pool_map(pool, length);
+  if (NULL == addr) {
+    free(slab);
+    return false;
+  }
+  slab->addr = addr;
+  slab->length = length;
+  pthread_mutex_lock(&pool->registry_mutex);
+  slab->next = pool->slabs;
+  pool->slabs = slab;
+  pthread_mutex_unlock(&pool->registry_mutex);
+
+  for (size_t i = 0; i < nblocks; i++) {
+    struct pool_block *block = (struct pool_block *)(addr + i * stride);
+    block->magic = POOL_MAGIC;
+    block->klass = klass;
+    block->next = pool->free[klass];
+    pool->free[klass] = block;
+  }
+  return true;
+}
+
+/**
+ * Counters are only written by the owner thread, relaxed accesses keep the
+ * concurrent reads of mem_pool_get_stats well defined
+ */
+static inline void stat_inc(uint64_t *counter) {
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + 1,
+                   __ATOMIC_RELAXED);
+}
+
+static inline uint64_t stat_get(const uint64_t *counter) {
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/**
+ * Gives @param keep blocks of @param klass from @param cache back to the free
+ * list, keeping the rest
+ */
+static void tcache_flush(struct pool_tcache *cache, unsigned int klass,
+                         unsigned int keep) {
+  mem_pool_t *pool = cache->pool;
+
+  pthread_mutex_lock(&pool->mutex[klass]);
+  while (cache->count[klass] > keep) {
+    struct pool_block *block = cache->blocks[klass];
+    cache->blocks[klass] = block->next;
+    cache->count[klass]--;
+    block->next = pool->free[klass];
+    pool->free[klass] = block;
+  }
+  pthread_mutex_unlock(&pool->mutex[klass]);
+}
+
+/**
+ * Thread exit: the cached blocks go back to the free lists and the counters
+ * are kept as retired
+ */
+static void tcache_release(void *arg) {
+  struct pool_tcache *cache = (struct pool_tcache *)arg;
+  mem_pool_t *pool = cache->pool;
+
+  for (unsigned int klass = 0; klass < POOL_CLASSES; klass++)
+    tcache_flush(cache, klass, 0);
+
+  pthread_mutex_lock(&pool->registry_mutex);
+  struct pool_tcache **link = &pool->caches;
+  while (*link != cache)
+    link = &(*link)->next;
+  *link = cache->next;
+  pool->retired.hits += cache->hits;
+  pool->retired.misses += cache->misses;
+  pool->retired.frees += cache->frees;
+  pool->retired.oversize += cache->oversize;
+  pthread_mutex_unlock(&pool->registry_mutex);
+  free(cache);
+}
+
+static struct pool_tcache *tcache_get(mem_pool_t *pool) {
+  struct pool_tcache *cache =
+      (struct pool_tcache *)pthread_getspecific(pool->key);
+  if (NULL == cache) {
+    cache = (struct pool_tcache *)calloc(1, sizeof(*cache));
+    if (NULL == cache) {
+      printf("Memory allocation for the pool thread cache failed\n");
+    } else {
+      cache->pool = pool;
+      pthread_mutex_lock(&pool->registry_mutex);
+      cache->next = pool->caches;
+      pool->caches = cache;
+      pthread_mutex_unlock(&pool->registry_mutex);
+      pthread_setspecific(pool->key, cache);
+    }
+  }
+  return cache;
+}
+
+/**
+ * Fills the empty cache of @param klass with a batch from the free list,
+ * mapping a new slab when the list is empty
+ */
+static bool tcache_refill(struct pool_tcache *cache, unsigned int klass) {
+  mem_pool_t *pool = cache->pool;
+  const unsigned int batch = (class_cache_limit(klass) + 1U) / 2U;
+  bool success = true;
+
+  pthread_mutex_lock(&pool->mutex[klass]);
+  if (NULL == pool->free[klass]) {
+    success = pool_grow(pool, klass);
+    if (success)
+      stat_inc(&cache->misses);
+  } else {
+    stat_inc(&cache->hits);
+  }
+  while ((NULL != pool->free[klass]) && (cache->count[klass] < batch)) {
+    struct pool_block *block = pool->free[klass];
+    pool->free[klass] = block->next;
+    block->next = cache->blocks[klass];
+    cache->blocks[klass] = block;
+    cache->count[klass]++;
+  }
+  pthread_mutex_unlock(&pool->mutex[klass]);
+  return success;
+}
+
+mem_pool_t *mem_pool_create(bool hugepages) {
+  mem_pool_t *pool = (mem_pool_t *)calloc(1, sizeof(*pool));
+  if (NULL == pool) {
+    printf("Memory allocation for the pool failed\n");
+  } else {
+    int rc = pthread_key_create(&pool->key, tcache_release);
+    if (0 != rc) {
+      printf("pthread_key_create failed with error %d\n", rc);
+      free(pool);
+      return NULL;
+    }
+    pool->hugepages = hugepages;
+    pthread_mutex_init(&pool->registry_mutex, NULL);
+    for (unsigned int klass = 0; klass < POOL_CLASSES; klass++)
+      pthread_mutex_init(&pool->mutex[klass], NULL);
+  }
+  return pool;
+}
+
+void *mem_pool_alloc(mem_pool_t *pool, size_t length) {
+  struct pool_block *block = NULL;
+  struct pool_tcache *cache;
+
+  if (NULL == pool)
+    return malloc(length);
+  if (NULL == (cache = tcache_get(pool)))
+    return NULL;
+
+  const unsigned int klass = length_class(length);
+  if (POOL_OVERSIZE == klass) { /* Too big to be cached, map it alone */
+    const size_t mapped = round_to_pages(POOL_HEADER + length);
+    block = (struct pool_block *)pool_map(pool, mapped);
+    if (NULL != block) {
+      block->magic = POOL_MAGIC;
+      block->klass = POOL_OVERSIZE;
+      block->length = mapped;
+      stat_inc(&cache->oversize);
+    }
+  } else if (0 != cache->count[klass]) { /* Fast path, no lock */
+    block = cache->blocks[klass];
+    stat_inc(&cache->hits);
+  } else if (tcache_refill(cache, klass)) {
+    block = cache->blocks[klass];
+  }
+
+  if (NULL == block)
+    return NULL;
+  if (POOL_OVERSIZE != klass) {
+    cache->blocks[klass] = block->next;
+    cache->count[klass]--;
+  }
+  return (char *)block + POOL_HEADER;
+}
+
+void mem_pool_free(mem_pool_t *pool, void *buffer) {
+  if (NULL == pool) {
+    free(buffer);
+    return;
+  }
+  if (NULL == buffer)
+    return;
+
+  struct pool_block *block =
+      (struct pool_block *)((char *)buffer - POOL_HEADER);
+  if (POOL_MAGIC != block->magic) {
+    fprintf(stderr, "Aborting... %p was not allocated from the pool\n",
+            buffer);
+    abort(); /*Handling a bug*/
+  }
+
+  const unsigned int klass = block->klass;
+  struct pool_tcache *cache = tcache_get(pool);
+  if (POOL_OVERSIZE == klass) {
+    munmap(block, block->length);
+  } else if (NULL == cache) { /* straight to the free list */
+    pthread_mutex_lock(&pool->mutex[klass]);
+    block->next = pool->free[klass];
+    pool->free[klass] = block;
+    pthread_mutex_unlock(&pool->mutex[klass]);
+  } else {
+    if (cache->count[klass] == class_cache_limit(klass))
+      tcache_flush(cache, klass, cache->count[klass] / 2U);
+    block->next = cache->blocks[klass];
+    cache->blocks[klass] = block;
+    cache->count[klass]++;
+  }
+  if (NULL != cache)
+    stat_inc(&cache->frees);
+}
+
+void mem_pool_get_stats(mem_pool_t *pool, mem_pool_stats_t *stats) {
+  pthread_mutex_lock(&pool->registry_mutex);
+  *stats = pool->retired;
+  for (struct pool_tcache *cache = pool->caches; NULL != cache;
+       cache = cache->next) {
+    stats->hits += stat_get(&cache->hits);
+    stats->misses += stat_get(&cache->misses);
+    stats->frees += stat_get(&cache->frees);
+    stats->oversize += stat_get(&cache->oversize);
+  }
+  pthread_mutex_unlock(&pool->registry_mutex);
+}
+
+void mem_pool_destroy(mem_pool_t *pool) {
+  if (NULL == pool)
+    return;
+  /* No destructor may run on a pool going away */
+  pthread_key_delete(pool->key);
+  while (NULL != pool->caches) {
+    struct pool_tcache *cache = pool->caches;
+    pool->caches = cache->next;
+    free(cache);
+  }
+  while (NULL != pool->slabs) {
+    struct pool_slab *slab = pool->slabs;
+    pool->slabs = slab->next;
+    munmap(slab->addr, slab->length);
+    free(slab);
+  }
+  for (unsigned int klass = 0; klass < POOL_CLASSES; klass++)
+    pthread_mutex_destroy(&pool->mutex[klass]);
+  pthread_mutex_destroy(&pool->registry_mutex);
+  free(pool);
+}
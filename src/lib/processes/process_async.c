@@ -0,0 +1,171 @@
+/*******************************************************************************
+ * Copyright (C) 2023 by Salvador Z                                            *
+ *                                                                             *
+ * This file is part of ELSU                                                   *
+ *                                                                             *
+ *   Permission is hereby granted, free of charge, to any person obtaining a   *
+ *   copy of this software and associated documentation files (the Software)   *
+ *   to deal in the Software without restriction including without limitation  *
+ *   the rights to use, copy, modify, merge, publish, distribute, sublicense,  *
+ *   and/or sell copies ot the Software, and to permit persons to whom the     *
+ *   Software is furnished to do so, subject to the following conditions:      *
+ *                                                                             *
+ *   The above copyright notice and this permission notice shall be included   *
+ *   in all copies or substantial portions of the Software.                    *
+ *                                                                             *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS   *
+ *   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARANTIES OF MERCHANTABILITY *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL   *
+ *   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR      *
+ *   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,     *
+ *   ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE        *
+ *   OR OTHER DEALINGS IN THE SOFTWARE.                                        *
+ ******************************************************************************/
+
+/**
+ * @file process_async.c
+ * @author Salvador Z
+ * @date 17 Oct 2026
+ * @brief File for spawning processes without waiting for them
+ *
+ * A pidfd refers to the child itself (not to a pid that could be recycled)
+ * and becomes readable once the child terminates, so a single thread can
+ * watch any amount of children with poll or epoll and reap each one with
+ * `wait4` to get its exit status and resource usage.
+ *
+ * @see https://man7.org/linux/man-pages/man2/pidfd_open.2.html
+ * @see https://linux.die.net/man/2/wait4
+ */
+
+#include "processes.h"
+
+#include <errno.h>
+#include <poll.h> /*poll*/
+#include <stdlib.h> /*NULL (stddef)*/
+#include <string.h> /*memset*/
+#include <sys/syscall.h> /*SYS_pidfd_open*/
+#include <sys/wait.h> /*wait4, waitid*/
+#include <time.h> /*clock_gettime*/
+#include <unistd.h> /*syscall, close*/
+
+/* Poll period of the children without a pidfd */
+#define PROCESS_POLL_SLICE_MS 10
+
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+  return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+  (void)pid;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+int process_spawn_async(process_handle_t *handle, const char *program,
+                        char *const *arg_list,
+                        const posix_spawn_file_actions_t *file_actions,
+                        const posix_spawnattr_t *attr, char *const *envp) {
+  handle->pid = -1;
+  handle->pidfd = -1;
+  handle->start_ns = now_ns();
+
+  int rc = process_spawn_ex(&handle->pid, program, arg_list, file_actions,
+                            attr, envp);
+  if (0 == rc)
+    /* The child is not reaped yet, its pid can't have been reused */
+    handle->pidfd = open_pidfd(handle->pid);
+  return rc;
+}
+
+int process_wait(process_handle_t *handle, process_result_t *result,
+                 bool block) {
+  int status = 0;
+  pid_t pid;
+
+  memset(result, 0, sizeof(*result));
+  do {
+    pid = wait4(handle->pid, &status, block ? 0 : WNOHANG, &result->usage);
+  } while ((-1 == pid) && (EINTR == errno));
+
+  if (-1 == pid)
+    return errno;
+  if (0 == pid)
+    return EAGAIN; /* still running */
+
+  result->wall_ns = now_ns() - handle->start_ns;
+  if (WIFSIGNALED(status)) {
+    result->exit_code = -1;
+    result->term_signal = WTERMSIG(status);
+  } else {
+    result->exit_code = WEXITSTATUS(status);
+  }
+  if (-1 != handle->pidfd)
+    close(handle->pidfd);
+  handle->pidfd = -1;
+  handle->pid = -1;
+  return 0;
+}
+
+/**
+ * Tells whether the child @param pid has exited, without reaping it
+ */
+static bool has_exited(pid_t pid) {
+  siginfo_t info;
+  memset(&info, 0, sizeof(info));
+  return (0 == waitid(P_PID, (id_t)pid, &info, WEXITED | WNOHANG | WNOWAIT)) &&
+         (0 != info.si_pid);
+}
+
+int process_poll(const process_handle_t *handles, size_t count,
+                 int timeout_ms) {
+  struct pollfd *fds = (struct pollfd *)calloc(count ? count : 1,
+                                               sizeof(struct pollfd));
+  uint64_t deadline = now_ns() + (uint64_t)timeout_ms * 1000000ULL;
+  bool without_pidfd = false;
+  int ready = -1;
+
+  if (NULL == fds)
+    return -1;
+  for (size_t i = 0; i < count; i++) {
+    /* A negative fd is ignored by poll */
+    fds[i].fd = (-1 == handles[i].pid) ? -1 : handles[i].pidfd;
+    fds[i].events = POLLIN;
+    without_pidfd |= ((-1 != handles[i].pid) && (-1 == handles[i].pidfd));
+  }
+
+  for (;;) {
+    for (size_t i = 0; without_pidfd && (i < count) && (-1 == ready); i++)
+      if ((-1 != handles[i].pid) && (-1 == handles[i].pidfd) &&
+          has_exited(handles[i].pid))
+        ready = (int)i;
+    if (-1 != ready)
+      break;
+
+    int slice = -1;
+    if (0 <= timeout_ms) {
+      uint64_t now = now_ns();
+      slice = (now >= deadline) ? 0 : (int)((deadline - now) / 1000000ULL);
+    }
+    if (without_pidfd && ((0 > slice) || (PROCESS_POLL_SLICE_MS < slice)))
+      slice = PROCESS_POLL_SLICE_MS;
+
+    int rc = poll(fds, (nfds_t)count, slice);
+    if ((-1 == rc) && (EINTR != errno))
+      break;
+    for (size_t i = 0; (0 < rc) && (i < count); i++)
+      if (0 != fds[i].revents) {
+        ready = (int)i;
+        break;
+      }
+    if ((-1 != ready) || ((0 <= timeout_ms) && (now_ns() >= deadline)))
+      break;
+  }
+  free(fds);
+  return ready;
+}
\ No newline at end of file
@@ -0,0 +1,218 @@
+/*******************************************************************************
+ * Copyright (C) 2023 by Salvador Z                                            *
+ *                                                                             *
+ * This file is part of ELSU                                                   *
+ *                                                                             *
+ *   Permission is hereby granted, free of charge, to any person obtaining a   *
+ *   copy of this software and associated documentation files (the Software)   *
+ *   to deal in the Software without restriction including without limitation  *
+ *   the rights to use, copy, modify, merge, publish, distribute, sublicense,  *
+ *   and/or sell copies ot the Software, and to permit persons to whom the     *
+ *   Software is furnished to do so, subject to the following conditions:      *
+ *                                                                             *
+ *   The above copyright notice and this permission notice shall be included   *
+ *   in all copies or substantial portions of the Software.                    *
+ *                                                                             *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS   *
+ *   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARANTIES OF MERCHANTABILITY *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL   *
+ *   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR      *
+ *   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,     *
+ *   ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE        *
+ *   OR OTHER DEALINGS IN THE SOFTWARE.                                        *
+ ******************************************************************************/
+
+/**
+ * @file process_capture.c
+ * @author Salvador Z
+ * @date 17 Oct 2026
+ * @brief File for running a program and harvesting its output
+ *
+ * stdout and stderr of the child are pipes (enlarged with F_SETPIPE_SZ so
+ * the child is woken less often). Towards a descriptor the data is moved
+ * with `splice`, the pages go from the pipe to the destination without a
+ * copy in user space. Towards memory it is read straight into the growable
+ * buffer, skipping the extra copy of a stdio stream (popen + fgets).
+ *
+ * @see https://man7.org/linux/man-pages/man2/splice.2.html
+ */
+
+#define _GNU_SOURCE /*splice, pipe2, F_SETPIPE_SZ*/
+#include "processes.h"
+
+#include <errno.h>
+#include <fcntl.h>  /*pipe2, splice, fcntl*/
+#include <poll.h>   /*poll*/
+#include <stdlib.h> /*realloc, free*/
+#include <unistd.h> /*read, write, close*/
+
+/* Requested pipe capacity, limited by /proc/sys/fs/pipe-max-size */
+#define CAPTURE_PIPE_SIZE (1 << 20)
+/* First size of the buffer of a sink, doubled as the output grows */
+#define CAPTURE_BUFFER_SIZE (64 * 1024)
+/* Bytes of a read (or splice) from the pipe */
+#define CAPTURE_CHUNK (64 * 1024)
+
+struct capture_stream {
+  int pipe_fd;
+  process_sink_t *sink;
+  size_t size;  /* allocated bytes of sink->buffer */
+  bool splice;  /* false once the destination refused splice */
+};
+
+static bool write_full(int fd, const char *data, size_t length) {
+  while (0 < length) {
+    ssize_t n = write(fd, data, length);
+    if (-1 == n) {
+      if (EINTR == errno)
+        continue;
+      return false;
+    }
+    data += n;
+    length -= (size_t)n;
+  }
+  return true;
+}
+
+/**
+ * Moves what is available in the pipe of @param stream to its sink
+ * @return ssize_t bytes moved, 0 at end of file, -1 on error (errno)
+ */
+static ssize_t drain(struct capture_stream *stream) {
+  process_sink_t *sink = stream->sink;
+  char chunk[CAPTURE_CHUNK];
+  ssize_t n;
+
+  if (-1 != sink->fd) {
+    if (stream->splice) {
+      n = splice(stream->pipe_fd, NULL, sink->fd, NULL, CAPTURE_CHUNK,
+                 SPLICE_F_MOVE | SPLICE_F_MORE);
+      if ((-1 != n) || (EINVAL != errno))
+        return n;
+      stream->splice = false; /* e.g. O_APPEND destination, copy instead */
+    }
+    n = read(stream->pipe_fd, chunk, sizeof(chunk));
+    if ((0 < n) && !write_full(sink->fd, chunk, (size_t)n))
+      return -1;
+    return n;
+  }
+
+  /* Keep room for a whole chunk and the final NUL */
+  if (stream->size - sink->length <= CAPTURE_CHUNK) {
+    size_t size = stream->size ? stream->size * 2 : CAPTURE_BUFFER_SIZE;
+    while (size - sink->length <= CAPTURE_CHUNK)
+      size *= 2;
+    char *grown = (char *)realloc(sink->buffer, size);
+    if (NULL == grown) {
+      errno = ENOMEM;
+      return -1;
+    }
+    sink->buffer = grown;
+    stream->size = size;
+  }
+  return read(stream->pipe_fd, sink->buffer + sink->length, CAPTURE_CHUNK);
+}
+
+/**
+ * Drains every stream until all of them reach the end of file
+ * @return int 0 on success, an errno value otherwise
+ */
+static int drain_all(struct capture_stream *streams, size_t count) {
+  struct pollfd fds[2];
+  size_t open = count;
+
+  for (size_t i = 0; i < count; i++) {
+    fds[i].fd = streams[i].pipe_fd;
+    fds[i].events = POLLIN;
+  }
+  while (0 < open) {
+    if (-1 == poll(fds, (nfds_t)count, -1)) {
+      if (EINTR == errno)
+        continue;
+      return errno;
+    }
+    for (size_t i = 0; i < count; i++) {
+      if (0 == fds[i].revents)
+        continue;
+      ssize_t n = drain(&streams[i]);
+      if (0 < n) {
+        streams[i].sink->length += (size_t)n;
+      } else if (0 == n) {
+        fds[i].fd = -1; /* end of file, poll ignores it from now on */
+        open--;
+      } else if (EINTR != errno) {
+        return errno;
+      }
+    }
+  }
+  return 0;
+}
+
+int process_spawn_capture(const char *program, char *const *arg_list,
+                          process_sink_t *out, process_sink_t *err,
+                          process_result_t *result) {
+  process_sink_t *sinks[2] = {out, (err != out) ? err : NULL};
+  struct capture_stream streams[2];
+  int pipes[2][2] = {{-1, -1}, {-1, -1}};
+  posix_spawn_file_actions_t actions;
+  process_handle_t child;
+  process_result_t ended;
+  size_t count = 0;
+  int rc = 0;
+
+  posix_spawn_file_actions_init(&actions);
+  for (int i = 0; (0 == rc) && (i < 2); i++) {
+    if (NULL == sinks[i])
+      continue;
+    if (-1 == pipe2(pipes[i], O_CLOEXEC)) {
+      rc = errno;
+      break;
+    }
+    fcntl(pipes[i][0], F_SETPIPE_SZ, CAPTURE_PIPE_SIZE); /* best effort */
+    posix_spawn_file_actions_adddup2(&actions, pipes[i][1], STDOUT_FILENO + i);
+    sinks[i]->length = 0;
+    if (-1 == sinks[i]->fd)
+      sinks[i]->buffer = NULL;
+    streams[count++] = (struct capture_stream){pipes[i][0], sinks[i], 0, true};
+  }
+  if ((NULL != out) && (err == out)) /* merged into the stdout pipe */
+    posix_spawn_file_actions_adddup2(&actions, pipes[0][1], STDERR_FILENO);
+
+  if (0 == rc)
+    rc = process_spawn_async(&child, program, arg_list, &actions, NULL, NULL);
+  posix_spawn_file_actions_destroy(&actions);
+  /* Only the child may hold the write ends, so its exit ends the streams */
+  for (int i = 0; i < 2; i++)
+    if (-1 != pipes[i][1])
+      close(pipes[i][1]);
+
+  if (0 == rc) {
+    rc = drain_all(streams, count);
+    /* On error the child gets SIGPIPE instead of blocking on a full pipe */
+    for (int i = 0; i < 2; i++)
+      if (-1 != pipes[i][0])
+        close(pipes[i][0]);
+    pipes[0][0] = pipes[1][0] = -1;
+
+    int wait_rc = process_wait(&child, (NULL != result) ? result : &ended,
+                               true);
+    if (0 == rc)
+      rc = wait_rc;
+  }
+  for (int i = 0; i < 2; i++)
+    if (-1 != pipes[i][0])
+      close(pipes[i][0]);
+
+  for (size_t i = 0; i < count; i++) {
+    process_sink_t *sink = streams[i].sink;
+    if (-1 != sink->fd)
+      continue;
+    if (NULL == sink->buffer)
+      sink->buffer = (char *)malloc(1);
+    if (NULL != sink->buffer)
+      sink->buffer[sink->length] = '\0';
+    else if (0 == rc)
+      rc = ENOMEM;
+  }
+  return rc;
+}
\ No newline at end of file
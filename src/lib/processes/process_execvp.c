@@ -30,6 +30,7 @@
  *
  *
  * @see https://linux.die.net/man/2/execvp
+ * @see https://man7.org/linux/man-pages/man3/posix_spawn.3.html
  * @see https://linux.die.net/man/2/wait
  */
 
@@ -38,11 +39,41 @@
 #include <errno.h>
 #include <stdio.h>  /*streams> fopen, fputs*/
 #include <stdlib.h> /*NULL (stddef)*/
+#include <string.h> /*strerror*/
 #include <sys/types.h> /*pid_t*/
 #include <sys/wait.h> /*waitpid*/
 #include <unistd.h> /*execvp*/
 
+extern char **environ;
+
+int process_spawn_ex(pid_t *pid, const char *program, char *const *arg_list,
+                     const posix_spawn_file_actions_t *file_actions,
+                     const posix_spawnattr_t *attr, char *const *envp) {
+  /* posix_spawnp returns the error, errno is left untouched */
+  return posix_spawnp(pid, program, file_actions, attr, arg_list,
+                      (NULL == envp) ? environ : envp);
+}
+
 int process_spawn(char *program, char **arg_list) {
+  process_handle_t child;
+  process_result_t result;
+  int rc = process_spawn_async(&child, program, arg_list, NULL, NULL, NULL);
+  if (0 != rc) {
+    fprintf(stderr, "Error in posix_spawnp of %s: %s\n", program,
+            strerror(rc));
+    return EXIT_FAILURE;
+  }
+  //the parent will sleep until child changes it's state
+  rc = process_wait(&child, &result, true);
+  if (0 != rc){
+    fprintf(stderr, "waitpid: %s\n", strerror(rc));
+    exit(EXIT_FAILURE);
+  }
+  return (0 != result.term_signal) ? 128 + result.term_signal
+                                   : result.exit_code;
+}
+
+int process_spawn_fork(char *program, char **arg_list) {
   pid_t child_pid;
   /* Duplicate this process. */
   child_pid = fork();
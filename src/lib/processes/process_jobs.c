@@ -0,0 +1,190 @@
+/*******************************************************************************
+ * Copyright (C) 2023 by Salvador Z                                            *
+ *                                                                             *
+ * This file is part of ELSU                                                   *
+ *                                                                             *
+ *   Permission is hereby granted, free of charge, to any person obtaining a   *
+ *   copy of this software and associated documentation files (the Software)   *
+ *   to deal in the Software without restriction including without limitation  *
+ *   the rights to use, copy, modify, merge, publish, distribute, sublicense,  *
+ *   and/or sell copies ot the Software, and to permit persons to whom the     *
+ *   Software is furnished to do so, subject to the following conditions:      *
+ *                                                                             *
+ *   The above copyright notice and this permission notice shall be included   *
+ *   in all copies or substantial portions of the Software.                    *
+ *                                                                             *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS   *
+ *   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARANTIES OF MERCHANTABILITY *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL   *
+ *   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR      *
+ *   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,     *
+ *   ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE        *
+ *   OR OTHER DEALINGS IN THE SOFTWARE.                                        *
+ ******************************************************************************/
+
+/**
+ * @file process_jobs.c
+ * @author Salvador Z
+ * @date 17 Oct 2026
+ * @brief File for running a batch of commands in parallel
+ *
+ * The runner keeps a fixed number of slots busy, watching the pidfd of
+ * every running child with a single poll. Pinning is done by moving the
+ * calling thread to the CPU of the slot just for the spawn, the child
+ * inherits that affinity mask before it executes a single instruction.
+ *
+ * @see https://man7.org/linux/man-pages/man2/sched_setaffinity.2.html
+ */
+
+#define _GNU_SOURCE /*sched_setaffinity, CPU_SET*/
+#include "processes.h"
+
+#include <errno.h>
+#include <sched.h> /*sched_getaffinity, sched_setaffinity, CPU_* */
+#include <signal.h> /*kill*/
+#include <stdlib.h> /*calloc, free*/
+#include <string.h> /*memset*/
+#include <unistd.h> /*sysconf, close*/
+
+static bool job_failed(const process_job_t *job) {
+  return (PROCESS_JOB_SPAWN_FAILED == job->state) ||
+         ((PROCESS_JOB_DONE == job->state) &&
+          ((0 != job->result.exit_code) || (0 != job->result.term_signal)));
+}
+
+/**
+ * Spawns @param job with the calling thread temporarily bound to @param cpu
+ * (when not -1) so the child starts already pinned.
+ */
+static int spawn_job(process_handle_t *handle, process_job_t *job, int cpu,
+                     const cpu_set_t *own_mask) {
+  cpu_set_t pin;
+  bool pinned = false;
+
+  if (-1 != cpu) {
+    CPU_ZERO(&pin);
+    CPU_SET(cpu, &pin);
+    pinned = (0 == sched_setaffinity(0, sizeof(pin), &pin));
+  }
+  int rc = process_spawn_async(handle, job->arg_list[0], job->arg_list, NULL,
+                               NULL, NULL);
+  if (pinned)
+    sched_setaffinity(0, sizeof(*own_mask), own_mask);
+  return rc;
+}
+
+static void stop_running(const process_handle_t *slots, size_t max_jobs) {
+  for (size_t k = 0; k < max_jobs; k++)
+    if (-1 != slots[k].pid)
+      kill(slots[k].pid, SIGTERM);
+}
+
+int process_run_jobs(process_job_t *jobs, size_t count,
+                     const process_jobs_opts_t *opts) {
+  process_jobs_opts_t defaults = {0, false, PROCESS_JOBS_CONTINUE};
+  cpu_set_t own_mask;
+  int cpus[CPU_SETSIZE];
+  int ncpus = 0;
+
+  if (NULL == opts)
+    opts = &defaults;
+
+  /* Slot k runs on the k-th CPU this thread is allowed to use */
+  CPU_ZERO(&own_mask);
+  if (0 == sched_getaffinity(0, sizeof(own_mask), &own_mask))
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+      if (CPU_ISSET(cpu, &own_mask))
+        cpus[ncpus++] = cpu;
+
+  size_t max_jobs = opts->max_jobs;
+  if (0 == max_jobs) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    max_jobs = (0 < online) ? (size_t)online : 1;
+  }
+  if (max_jobs > count)
+    max_jobs = count ? count : 1;
+
+  process_handle_t *slots = calloc(max_jobs, sizeof(process_handle_t));
+  size_t *slot_job = calloc(max_jobs, sizeof(size_t));
+  if ((NULL == slots) || (NULL == slot_job)) {
+    free(slots);
+    free(slot_job);
+    return -1;
+  }
+  for (size_t k = 0; k < max_jobs; k++) {
+    slots[k].pid = -1;
+    slots[k].pidfd = -1;
+  }
+  for (size_t i = 0; i < count; i++) {
+    jobs[i].state = PROCESS_JOB_PENDING;
+    jobs[i].error = 0;
+    memset(&jobs[i].result, 0, sizeof(jobs[i].result));
+  }
+
+  size_t next = 0, active = 0;
+  bool stop = false, stopped = false;
+  int failures = 0;
+
+  while (true) {
+    /* Fill the free slots */
+    for (size_t k = 0; (k < max_jobs) && (next < count) && !stop;) {
+      if (-1 != slots[k].pid) {
+        k++;
+        continue;
+      }
+      process_job_t *job = &jobs[next];
+      int cpu = job->pin ? job->cpu : -1;
+      if ((-1 == cpu) && opts->pin_cpus && (0 < ncpus))
+        cpu = cpus[k % (size_t)ncpus];
+
+      int rc = spawn_job(&slots[k], job, cpu, &own_mask);
+      if (0 == rc) {
+        slot_job[k] = next;
+        active++;
+      } else { /* the slot stays free for the next job */
+        job->state = PROCESS_JOB_SPAWN_FAILED;
+        job->error = rc;
+        slots[k].pid = -1;
+        failures++;
+        stop |= (PROCESS_JOBS_FAIL_FAST == opts->policy);
+      }
+      next++;
+    }
+    if (0 == active)
+      break;
+    if (stop && !stopped) { /* fail-fast */
+      stop_running(slots, max_jobs);
+      stopped = true;
+    }
+
+    int k = process_poll(slots, max_jobs, -1);
+    if (-1 == k) /* shouldn't happen, block on any running child */
+      for (k = 0; -1 == slots[k].pid; k++)
+        ;
+    process_job_t *job = &jobs[slot_job[k]];
+    int rc = process_wait(&slots[k], &job->result, true);
+    if (0 != rc) { /* e.g. ECHILD, reaped by someone else */
+      job->state = PROCESS_JOB_SPAWN_FAILED;
+      job->error = rc;
+      if (-1 != slots[k].pidfd)
+        close(slots[k].pidfd);
+      slots[k].pid = -1;
+      slots[k].pidfd = -1;
+    } else {
+      job->state = PROCESS_JOB_DONE;
+    }
+    active--;
+
+    if (job_failed(job)) {
+      failures++;
+      stop |= (PROCESS_JOBS_FAIL_FAST == opts->policy);
+    }
+  }
+
+  for (; next < count; next++)
+    jobs[next].state = PROCESS_JOB_SKIPPED;
+
+  free(slots);
+  free(slot_job);
+  return failures;
+}
\ No newline at end of file
@@ -0,0 +1,463 @@
+/*******************************************************************************
+ * Copyright (C) 2023 by Salvador Z                                            *
+ *                                                                             *
+ * This file is part of ELSU                                                   *
+ *                                                                             *
+ *   Permission is hereby granted, free of charge, to any person obtaining a   *
+ *   copy of this software and associated documentation files (the Software)   *
+ *   to deal in the Software without restriction including without limitation  *
+ *   the rights to use, copy, modify, merge, publish, distribute, sublicense,  *
+ *   and/or sell copies ot the Software, and to permit persons to whom the     *
+ *   Software is furnished to do so, subject to the following conditions:      *
+ *                                                                             *
+ *   The above copyright notice and this permission notice shall be included   *
+ *   in all copies or substantial portions of the Software.                    *
+ *                                                                             *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS   *
+ *   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARANTIES OF MERCHANTABILITY *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL   *
+ *   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR      *
+ *   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,     *
+ *   ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE        *
+ *   OR OTHER DEALINGS IN THE SOFTWARE.                                        *
+ ******************************************************************************/
+
+/**
+ * @file process_zygote.c
+ * @author Salvador Z
+ * @date 17 Oct 2026
+ * @brief File for spawning processes through a pre-forked helper
+ *
+ * The zygote is forked once, early, while the parent is small. From then on
+ * it waits for requests on a SOCK_SEQPACKET socketpair (one message per
+ * request: argv and envp packed as strings, the descriptors for the child
+ * as SCM_RIGHTS) and spawns the children itself, so the big long-running
+ * parent never duplicates its page tables. The zygote reaps the children
+ * (SIGCHLD through a signalfd) and reports their exit back on the socket.
+ *
+ * @see https://man7.org/linux/man-pages/man7/unix.7.html
+ * @see https://man7.org/linux/man-pages/man2/signalfd.2.html
+ */
+
+#define _GNU_SOURCE /*close_range*/
+#include "processes.h"
+
+#include <errno.h>
+#include <fcntl.h>  /*fcntl*/
+#include <poll.h>   /*poll*/
+#include <signal.h> /*sigprocmask*/
+#include <stdio.h>  /*perror*/
+#include <stdlib.h> /*malloc, free*/
+#include <string.h> /*memcpy, strlen*/
+#include <sys/signalfd.h> /*signalfd*/
+#include <sys/socket.h>   /*socketpair, sendmsg, recvmsg*/
+#include <sys/wait.h>     /*wait4, waitpid*/
+#include <time.h>   /*clock_gettime*/
+#include <unistd.h> /*fork, close*/
+
+/* Biggest request, argv + envp packed */
+#define ZYGOTE_MAX_MSG (64 * 1024)
+/* envc of a request that keeps the zygote environment */
+#define ZYGOTE_INHERIT_ENV UINT32_MAX
+
+enum zygote_msg_type { ZYGOTE_MSG_SPAWNED = 1, ZYGOTE_MSG_EXITED = 2 };
+
+/**
+ * Request, followed by argc + envc NUL terminated strings
+ */
+struct zygote_request {
+  uint32_t argc;
+  uint32_t envc;
+};
+
+struct zygote_reply {
+  uint32_t type;
+  int32_t pid;
+  int32_t error;
+  process_result_t result;
+};
+
+struct zygote_exit {
+  pid_t pid;
+  process_result_t result;
+};
+
+struct zygote {
+  pid_t pid;
+  int sock;
+  /* Exits read while looking for another message, not waited yet */
+  struct zygote_exit *exited;
+  size_t exited_count;
+  size_t exited_size;
+};
+
+/* Zygote side */
+
+struct zygote_child {
+  pid_t pid;
+  uint64_t start_ns;
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Splits @param count NUL terminated strings of @param msg (up to @param end)
+ * into a null terminated list
+ */
+static char **unpack_strings(char **msg, const char *end, uint32_t count) {
+  char **list = (char **)calloc((size_t)count + 1, sizeof(char *));
+  for (uint32_t i = 0; (NULL != list) && (i < count); i++) {
+    char *nul = memchr(*msg, '\0', (size_t)(end - *msg));
+    if (NULL == nul) {
+      free(list);
+      return NULL;
+    }
+    list[i] = *msg;
+    *msg = nul + 1;
+  }
+  return list;
+}
+
+static int zygote_do_spawn(char *msg, size_t length, const int *fds,
+                           size_t nfds, pid_t *pid) {
+  struct zygote_request request;
+  char *cursor = msg + sizeof(request);
+  const char *end = msg + length;
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  sigset_t none;
+  int high[ZYGOTE_MAX_FDS];
+  char **argv = NULL, **envp = NULL;
+  int rc = EINVAL;
+
+  if (length < sizeof(request))
+    return EINVAL;
+  memcpy(&request, msg, sizeof(request));
+  argv = unpack_strings(&cursor, end, request.argc);
+  if (ZYGOTE_INHERIT_ENV != request.envc)
+    envp = unpack_strings(&cursor, end, request.envc);
+
+  if ((NULL != argv) && (NULL != argv[0]) &&
+      ((ZYGOTE_INHERIT_ENV == request.envc) || (NULL != envp))) {
+    /* Move the received fds above the targets so no dup2 clobbers them */
+    posix_spawn_file_actions_init(&actions);
+    for (size_t i = 0; i < nfds; i++) {
+      high[i] = fcntl(fds[i], F_DUPFD_CLOEXEC, (int)nfds);
+      posix_spawn_file_actions_adddup2(&actions, high[i], (int)i);
+    }
+    /* The children must not inherit the blocked SIGCHLD */
+    sigemptyset(&none);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+    rc = process_spawn_ex(pid, argv[0], argv, &actions, &attr, envp);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    for (size_t i = 0; i < nfds; i++)
+      if (-1 != high[i])
+        close(high[i]);
+  }
+  free(argv);
+  free(envp);
+  return rc;
+}
+
+/**
+ * Receives one request and answers it with ZYGOTE_MSG_SPAWNED
+ * @return false when the parent is gone
+ */
+static bool zygote_serve_request(int sock, char *msg, uint64_t *start_ns,
+                                 pid_t *pid) {
+  union {
+    char buf[CMSG_SPACE(sizeof(int) * ZYGOTE_MAX_FDS)];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = {msg, ZYGOTE_MAX_MSG};
+  struct msghdr hdr = {0};
+  struct zygote_reply reply = {0};
+  int fds[ZYGOTE_MAX_FDS];
+  size_t nfds = 0;
+
+  hdr.msg_iov = &iov;
+  hdr.msg_iovlen = 1;
+  hdr.msg_control = control.buf;
+  hdr.msg_controllen = sizeof(control.buf);
+  ssize_t length = recvmsg(sock, &hdr, MSG_CMSG_CLOEXEC);
+  if (0 >= length)
+    return (-1 == length) && (EINTR == errno);
+
+  for (struct cmsghdr *c = CMSG_FIRSTHDR(&hdr); NULL != c;
+       c = CMSG_NXTHDR(&hdr, c))
+    if ((SOL_SOCKET == c->cmsg_level) && (SCM_RIGHTS == c->cmsg_type)) {
+      nfds = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      memcpy(fds, CMSG_DATA(c), nfds * sizeof(int));
+    }
+
+  *pid = -1;
+  *start_ns = now_ns();
+  reply.type = ZYGOTE_MSG_SPAWNED;
+  reply.error = (hdr.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+                    ? E2BIG
+                    : zygote_do_spawn(msg, (size_t)length, fds, nfds, pid);
+  reply.pid = (0 == reply.error) ? *pid : -1;
+  for (size_t i = 0; i < nfds; i++)
+    close(fds[i]);
+  send(sock, &reply, sizeof(reply), MSG_NOSIGNAL);
+  return true;
+}
+
+static void zygote_reap(int sock, struct zygote_child *children,
+                        size_t *count) {
+  struct zygote_reply reply = {0};
+  int status;
+  pid_t pid;
+
+  reply.type = ZYGOTE_MSG_EXITED;
+  while (0 < (pid = wait4(-1, &status, WNOHANG, &reply.result.usage))) {
+    uint64_t start_ns = now_ns();
+    for (size_t i = 0; i < *count; i++)
+      if (pid == children[i].pid) {
+        start_ns = children[i].start_ns;
+        children[i] = children[--(*count)];
+        break;
+      }
+    reply.pid = pid;
+    reply.result.wall_ns = now_ns() - start_ns;
+    reply.result.exit_code = WIFSIGNALED(status) ? -1 : WEXITSTATUS(status);
+    reply.result.term_signal = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+    send(sock, &reply, sizeof(reply), MSG_NOSIGNAL);
+  }
+}
+
+static void zygote_serve(int sock) {
+  struct zygote_child *children = NULL;
+  size_t count = 0, size = 0;
+  struct signalfd_siginfo info;
+  sigset_t chld;
+
+  /* Keep the stdio and the socket, drop what the parent had open */
+  if (3 != sock) {
+    dup2(sock, 3);
+    close(sock);
+    sock = 3;
+  }
+  fcntl(sock, F_SETFD, FD_CLOEXEC);
+  close_range(4, ~0U, 0);
+
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld, NULL);
+  int sfd = signalfd(-1, &chld, SFD_CLOEXEC | SFD_NONBLOCK);
+  char *msg = (char *)malloc(ZYGOTE_MAX_MSG);
+  if ((-1 == sfd) || (NULL == msg))
+    _exit(EXIT_FAILURE);
+
+  struct pollfd pfd[2] = {{sock, POLLIN, 0}, {sfd, POLLIN, 0}};
+  for (;;) {
+    if ((-1 == poll(pfd, 2, -1)) && (EINTR != errno))
+      break;
+    if (pfd[1].revents) {
+      while (sizeof(info) == read(sfd, &info, sizeof(info)))
+        ;
+      zygote_reap(sock, children, &count);
+    }
+    if (pfd[0].revents) {
+      uint64_t start_ns = 0;
+      pid_t pid = -1;
+      if (count == size) {
+        size = size ? size * 2 : 64;
+        struct zygote_child *grown = realloc(children, size * sizeof(*grown));
+        if (NULL == grown)
+          break;
+        children = grown;
+      }
+      if (!zygote_serve_request(sock, msg, &start_ns, &pid))
+        break;
+      if (-1 != pid)
+        children[count++] = (struct zygote_child){pid, start_ns};
+    }
+  }
+  _exit(EXIT_SUCCESS);
+}
+
+/* Parent side */
+
+zygote_t *zygote_start(void) {
+  zygote_t *zygote = (zygote_t *)calloc(1, sizeof(zygote_t));
+  int sv[2];
+
+  if (NULL == zygote)
+    return NULL;
+  if (-1 == socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv)) {
+    perror("socketpair");
+    free(zygote);
+    return NULL;
+  }
+  zygote->pid = fork();
+  if (0 == zygote->pid) {
+    close(sv[0]);
+    zygote_serve(sv[1]);
+  }
+  close(sv[1]);
+  if (-1 == zygote->pid) {
+    perror("fork");
+    close(sv[0]);
+    free(zygote);
+    return NULL;
+  }
+  zygote->sock = sv[0];
+  return zygote;
+}
+
+static int zygote_read(zygote_t *zygote, struct zygote_reply *reply,
+                       bool block) {
+  ssize_t length;
+  do {
+    length = recv(zygote->sock, reply, sizeof(*reply),
+                  block ? 0 : MSG_DONTWAIT);
+  } while ((-1 == length) && (EINTR == errno));
+
+  if (-1 == length)
+    return errno;
+  return (sizeof(*reply) == (size_t)length) ? 0 : EPIPE; /* zygote died */
+}
+
+static int zygote_keep_exit(zygote_t *zygote,
+                            const struct zygote_reply *reply) {
+  if (zygote->exited_count == zygote->exited_size) {
+    size_t size = zygote->exited_size ? zygote->exited_size * 2 : 16;
+    struct zygote_exit *grown =
+        realloc(zygote->exited, size * sizeof(struct zygote_exit));
+    if (NULL == grown)
+      return ENOMEM;
+    zygote->exited = grown;
+    zygote->exited_size = size;
+  }
+  zygote->exited[zygote->exited_count].pid = reply->pid;
+  zygote->exited[zygote->exited_count++].result = reply->result;
+  return 0;
+}
+
+/**
+ * Appends @param count strings of @param list to @param msg
+ * @return size_t new length, 0 when it doesn't fit
+ */
+static size_t pack_strings(char *msg, size_t length, char *const *list,
+                           uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    size_t size = strlen(list[i]) + 1;
+    if (size > ZYGOTE_MAX_MSG - length)
+      return 0;
+    memcpy(msg + length, list[i], size);
+    length += size;
+  }
+  return length;
+}
+
+int zygote_spawn(zygote_t *zygote, pid_t *pid, char *const *arg_list,
+                 char *const *envp, const int *fds, size_t nfds) {
+  union {
+    char buf[CMSG_SPACE(sizeof(int) * ZYGOTE_MAX_FDS)];
+    struct cmsghdr align;
+  } control;
+  struct zygote_request request = {0, ZYGOTE_INHERIT_ENV};
+  struct msghdr hdr = {0};
+  struct zygote_reply reply;
+  struct iovec iov;
+  int rc = 0;
+
+  if ((NULL == arg_list) || (NULL == arg_list[0]) || (ZYGOTE_MAX_FDS < nfds))
+    return EINVAL;
+  while (NULL != arg_list[request.argc])
+    request.argc++;
+  if (NULL != envp)
+    for (request.envc = 0; NULL != envp[request.envc];)
+      request.envc++;
+
+  char *msg = (char *)malloc(ZYGOTE_MAX_MSG);
+  if (NULL == msg)
+    return ENOMEM;
+  memcpy(msg, &request, sizeof(request));
+  size_t length = pack_strings(msg, sizeof(request), arg_list, request.argc);
+  if ((0 != length) && (NULL != envp))
+    length = pack_strings(msg, length, envp, request.envc);
+
+  if (0 == length) {
+    rc = E2BIG;
+  } else {
+    iov.iov_base = msg;
+    iov.iov_len = length;
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    if (0 < nfds) {
+      hdr.msg_control = control.buf;
+      hdr.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+      struct cmsghdr *c = CMSG_FIRSTHDR(&hdr);
+      c->cmsg_level = SOL_SOCKET;
+      c->cmsg_type = SCM_RIGHTS;
+      c->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+      memcpy(CMSG_DATA(c), fds, sizeof(int) * nfds);
+    }
+    ssize_t sent;
+    do {
+      sent = sendmsg(zygote->sock, &hdr, MSG_NOSIGNAL);
+    } while ((-1 == sent) && (EINTR == errno));
+    if (-1 == sent)
+      rc = errno;
+  }
+  free(msg);
+  if (0 != rc)
+    return rc;
+
+  /* Exits of other children may come before the answer */
+  while (0 == (rc = zygote_read(zygote, &reply, true))) {
+    if (ZYGOTE_MSG_SPAWNED == reply.type) {
+      *pid = reply.pid;
+      return reply.error;
+    }
+    if (0 != (rc = zygote_keep_exit(zygote, &reply)))
+      break;
+  }
+  return rc;
+}
+
+int zygote_wait(zygote_t *zygote, pid_t pid, process_result_t *result,
+                bool block) {
+  struct zygote_reply reply;
+  int rc;
+
+  for (size_t i = 0; i < zygote->exited_count; i++)
+    if (pid == zygote->exited[i].pid) {
+      *result = zygote->exited[i].result;
+      zygote->exited[i] = zygote->exited[--zygote->exited_count];
+      return 0;
+    }
+  while (0 == (rc = zygote_read(zygote, &reply, block))) {
+    if (ZYGOTE_MSG_EXITED != reply.type)
+      continue;
+    if (pid == reply.pid) {
+      *result = reply.result;
+      return 0;
+    }
+    if (0 != (rc = zygote_keep_exit(zygote, &reply)))
+      break;
+  }
+  return (EWOULDBLOCK == rc) ? EAGAIN : rc;
+}
+
+int zygote_fd(const zygote_t *zygote) { return zygote->sock; }
+
+void zygote_stop(zygote_t *zygote) {
+  if (NULL == zygote)
+    return;
+  close(zygote->sock); /* the zygote sees the end of file and leaves */
+  waitpid(zygote->pid, NULL, 0);
+  free(zygote->exited);
+  free(zygote);
+}
\ No newline at end of file
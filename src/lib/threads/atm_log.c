@@ -0,0 +1,384 @@
+/*******************************************************************************
+ * Copyright (C) 2023 by Salvador Z                                            *
+ *                                                                             *
+ * This file is part of ELSU                                                   *
+ *                                                                             *
+ *   Permission is hereby granted, free of charge, to any person obtaining a   *
+ *   copy of this software and associated documentation files (the Software)   *
+ *   to deal in the Software without restriction including without limitation  *
+ *   the rights to use, copy, modify, merge, publish, distribute, sublicense,  *
+ *   and/or sell copies ot the Software, and to permit persons to whom the     *
+ *   Software is furnished to do so, subject to the following conditions:      *
+ *                                                                             *
+ *   The above copyright notice and this permission notice shall be included   *
+ *   in all copies or substantial portions of the Software.                    *
+ *                                                                             *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS   *
+ *   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARANTIES OF MERCHANTABILITY *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL   *
+ *   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR      *
+ *   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,     *
+ *   ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE        *
+ *   OR OTHER DEALINGS IN THE SOFTWARE.                                        *
+ ******************************************************************************/
+
+/**
+ * @file atm_log.c
+ * @author Salvador Z
+ * @date 17 Oct 2026
+ * @brief File for logging from many threads without blocking them
+ *
+ * Every thread owns a single producer single consumer ring of binary
+ * records, created the first time it logs. The producer only copies the
+ * record and publishes it (a release store of head); a full ring drops the
+ * record instead of waiting. A single flusher thread walks the rings,
+ * formats the records into text chunks and hands them to the file with one
+ * `writev` per round, so neither the formatting nor the system call is
+ * paid by the threads doing the withdrawls. The flusher only holds the
+ * mutex of the ring list to take its first ring and to unlink the rings of
+ * exited threads, never while formatting or writing.
+ *
+ * @see https://man7.org/linux/man-pages/man2/writev.2.html
+ */
+
+#include "threads_atm_log.h"
+
+#include <errno.h>
+#include <fcntl.h>   /*open*/
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>   /*snprintf*/
+#include <stdlib.h>  /*aligned_alloc, free*/
+#include <string.h>  /*strncpy*/
+#include <sys/uio.h> /*writev*/
+#include <time.h>    /*clock_gettime, nanosleep*/
+#include <unistd.h>  /*close*/
+
+/* Records per ring, a power of two */
+#define ATM_LOG_RING_RECORDS 4096U
+/* Text chunks written by a single writev */
+#define ATM_LOG_CHUNKS 16U
+#define ATM_LOG_CHUNK_SIZE (64U * 1024U)
+/* Longest formatted record */
+#define ATM_LOG_LINE_MAX 128U
+/* Sleep of the flusher when every ring is empty */
+#define ATM_LOG_IDLE_NS 1000000L
+
+struct atm_log_ring {
+  /* Written by the owner thread only */
+  _Alignas(64) atomic_size_t head;
+  /* Written by the flusher only */
+  _Alignas(64) atomic_size_t tail;
+  _Alignas(64) atomic_bool closed; /* the owner thread exited */
+  atomic_uint_fast64_t dropped;
+  struct atm_log_ring *next;
+  bool released; /* drained after closing, only used by the flusher */
+  atm_log_record_t records[ATM_LOG_RING_RECORDS];
+};
+
+/**
+ * The ring of a thread, valid while generation is the one of the log
+ */
+struct atm_log_thread {
+  struct atm_log_ring *ring;
+  unsigned int generation;
+};
+
+static struct {
+  pthread_mutex_t mutex; /* rings, generation */
+  struct atm_log_ring *rings;
+  atomic_uint generation;
+  atomic_bool active;
+  atomic_bool running;
+  uint64_t dropped; /* by rings already released */
+  pthread_t flusher;
+  int fd;
+  char *chunks;
+} atm_log = {.mutex = PTHREAD_MUTEX_INITIALIZER, .fd = -1};
+
+static pthread_key_t atm_log_key;
+static pthread_once_t atm_log_key_once = PTHREAD_ONCE_INIT;
+static __thread struct atm_log_thread atm_log_self;
+
+/**
+ * Destructor of the thread specific data: lets the flusher release the
+ * ring of the exiting thread once it's drained
+ */
+static void atm_log_thread_exit(void *self) {
+  struct atm_log_thread *thread = (struct atm_log_thread *)self;
+
+  pthread_mutex_lock(&atm_log.mutex);
+  if ((NULL != thread->ring) && (thread->generation == atm_log.generation))
+    atomic_store_explicit(&thread->ring->closed, true, memory_order_release);
+  thread->ring = NULL;
+  pthread_mutex_unlock(&atm_log.mutex);
+}
+
+static void atm_log_create_key(void) {
+  pthread_key_create(&atm_log_key, atm_log_thread_exit);
+}
+
+/**
+ * The ring of the calling thread, created on the first record
+ */
+static struct atm_log_ring *atm_log_ring(void) {
+  struct atm_log_thread *self = &atm_log_self;
+  struct atm_log_ring *ring;
+
+  if ((NULL != self->ring) &&
+      (self->generation ==
+       atomic_load_explicit(&atm_log.generation, memory_order_relaxed)))
+    return self->ring;
+
+  ring = (struct atm_log_ring *)aligned_alloc(_Alignof(struct atm_log_ring),
+                                              sizeof(struct atm_log_ring));
+  if (NULL == ring)
+    return NULL;
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->closed, false);
+  atomic_init(&ring->dropped, 0);
+  ring->released = false;
+
+  pthread_mutex_lock(&atm_log.mutex);
+  ring->next = atm_log.rings;
+  atm_log.rings = ring;
+  self->ring = ring;
+  self->generation = atm_log.generation;
+  pthread_mutex_unlock(&atm_log.mutex);
+  pthread_setspecific(atm_log_key, self);
+  return ring;
+}
+
+bool atm_log_write(atm_log_event_t event, uint32_t amount, const char *text) {
+  struct atm_log_ring *ring;
+  struct timespec ts;
+
+  if (!atomic_load_explicit(&atm_log.active, memory_order_relaxed) ||
+      (NULL == (ring = atm_log_ring())))
+    return false;
+
+  const size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  const size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  if (ATM_LOG_RING_RECORDS == head - tail) {
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    return false;
+  }
+
+  atm_log_record_t *record = &ring->records[head & (ATM_LOG_RING_RECORDS - 1U)];
+  clock_gettime(CLOCK_REALTIME, &ts);
+  record->timestamp_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  record->thread = (uint64_t)pthread_self();
+  record->event = event;
+  record->amount = amount;
+  record->text[0] = '\0';
+  if (NULL != text) {
+    strncpy(record->text, text, ATM_LOG_TEXT - 1U);
+    record->text[ATM_LOG_TEXT - 1U] = '\0';
+  }
+  atomic_store_explicit(&ring->head, head + 1U, memory_order_release);
+  return true;
+}
+
+static size_t atm_log_format(char *line, const atm_log_record_t *record) {
+  const unsigned long long sec = record->timestamp_ns / 1000000000ULL;
+  const unsigned long nsec = (unsigned long)(record->timestamp_ns % 1000000000ULL);
+  int length;
+
+  switch (record->event) {
+  case ATM_LOG_APPROVED:
+    length = snprintf(line, ATM_LOG_LINE_MAX,
+                      "[%llu.%09lu] thread %llu: Withdrawl $%u approved\n",
+                      sec, nsec, (unsigned long long)record->thread,
+                      record->amount);
+    break;
+  case ATM_LOG_DISBURSE:
+    length = snprintf(line, ATM_LOG_LINE_MAX,
+                      "[%llu.%09lu] thread %llu: Disbursing $%u\n", sec, nsec,
+                      (unsigned long long)record->thread, record->amount);
+    break;
+  default:
+    length = snprintf(line, ATM_LOG_LINE_MAX, "[%llu.%09lu] thread %llu: %s\n",
+                      sec, nsec, (unsigned long long)record->thread,
+                      record->text);
+    break;
+  }
+  return (0 < length) ? (size_t)length : 0;
+}
+
+/**
+ * Writes @param count chunks of @param iov, resuming after partial writes
+ */
+static void atm_log_writev(struct iovec *iov, int count) {
+  while (0 < count) {
+    ssize_t written = writev(atm_log.fd, iov, count);
+    if (-1 == written) {
+      if (EINTR == errno)
+        continue;
+      perror("atm_log writev");
+      return;
+    }
+    while ((0 < count) && ((size_t)written >= iov->iov_len)) {
+      written -= (ssize_t)iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (0 < count) {
+      iov->iov_base = (char *)iov->iov_base + written;
+      iov->iov_len -= (size_t)written;
+    }
+  }
+}
+
+/**
+ * Formats and writes everything the rings hold, releasing the rings of the
+ * threads that exited
+ * @return true when there was something to write
+ */
+static bool atm_log_flush(void) {
+  struct iovec iov[ATM_LOG_CHUNKS];
+  char *chunk = atm_log.chunks;
+  struct atm_log_ring *first;
+  size_t used = 0;
+  int chunks = 0;
+  bool wrote = false, release = false;
+
+  /* Rings are only added in front and only the flusher unlinks them, the
+     list after the first one can be walked without the mutex */
+  pthread_mutex_lock(&atm_log.mutex);
+  first = atm_log.rings;
+  pthread_mutex_unlock(&atm_log.mutex);
+
+  for (struct atm_log_ring *ring = first; NULL != ring; ring = ring->next) {
+    const bool closed =
+        atomic_load_explicit(&ring->closed, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    const size_t head =
+        atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    for (; tail != head; tail++) {
+      if (ATM_LOG_CHUNK_SIZE - used < ATM_LOG_LINE_MAX) {
+        iov[chunks++] = (struct iovec){chunk, used};
+        if (ATM_LOG_CHUNKS == chunks) {
+          atm_log_writev(iov, chunks);
+          chunks = 0;
+        }
+        chunk = atm_log.chunks + (size_t)chunks * ATM_LOG_CHUNK_SIZE;
+        used = 0;
+      }
+      used += atm_log_format(
+          chunk + used, &ring->records[tail & (ATM_LOG_RING_RECORDS - 1U)]);
+      wrote = true;
+    }
+    /* The records are copied into the chunks, their slots can be reused */
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    /* Closed before draining it, nothing is left to write */
+    ring->released = closed;
+    release |= closed;
+  }
+
+  if (0 < used)
+    iov[chunks++] = (struct iovec){chunk, used};
+  atm_log_writev(iov, chunks);
+
+  if (release) {
+    pthread_mutex_lock(&atm_log.mutex);
+    for (struct atm_log_ring **link = &atm_log.rings; NULL != *link;) {
+      struct atm_log_ring *ring = *link;
+      if (ring->released) {
+        *link = ring->next;
+        atm_log.dropped += atomic_load(&ring->dropped);
+        free(ring);
+      } else {
+        link = &ring->next;
+      }
+    }
+    pthread_mutex_unlock(&atm_log.mutex);
+  }
+  return wrote;
+}
+
+static void *atm_log_flusher(void *arg) {
+  const struct timespec idle = {0, ATM_LOG_IDLE_NS};
+
+  while (atomic_load_explicit(&atm_log.running, memory_order_acquire))
+    if (!atm_log_flush())
+      nanosleep(&idle, NULL);
+  atm_log_flush(); /* what was written before the stop */
+  return arg;
+}
+
+bool atm_log_start(const char *path) {
+  int rc;
+
+  if (atomic_load(&atm_log.active))
+    return false;
+  pthread_once(&atm_log_key_once, atm_log_create_key);
+  atm_log.chunks = (char *)malloc((size_t)ATM_LOG_CHUNKS * ATM_LOG_CHUNK_SIZE);
+  atm_log.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if ((NULL == atm_log.chunks) || (-1 == atm_log.fd)) {
+    printf("Failed to open the atm log %s: %s\n", path, strerror(errno));
+    free(atm_log.chunks);
+    if (-1 != atm_log.fd)
+      close(atm_log.fd);
+    atm_log.fd = -1;
+    return false;
+  }
+
+  pthread_mutex_lock(&atm_log.mutex);
+  atm_log.generation++; /* rings of a previous run are gone */
+  atm_log.dropped = 0;
+  pthread_mutex_unlock(&atm_log.mutex);
+
+  atomic_store(&atm_log.running, true);
+  rc = pthread_create(&atm_log.flusher, NULL, atm_log_flusher, NULL);
+  if (0 != rc) {
+    printf("pthread_create failed with %s for the atm log\n", strerror(rc));
+    atomic_store(&atm_log.running, false);
+    close(atm_log.fd);
+    atm_log.fd = -1;
+    free(atm_log.chunks);
+    return false;
+  }
+  atomic_store(&atm_log.active, true);
+  return true;
+}
+
+void atm_log_stop(void) {
+  if (!atomic_load(&atm_log.active))
+    return;
+  atomic_store(&atm_log.active, false);
+  atomic_store_explicit(&atm_log.running, false, memory_order_release);
+  pthread_join(atm_log.flusher, NULL);
+
+  pthread_mutex_lock(&atm_log.mutex);
+  while (NULL != atm_log.rings) {
+    struct atm_log_ring *ring = atm_log.rings;
+    atm_log.rings = ring->next;
+    atm_log.dropped += atomic_load(&ring->dropped);
+    free(ring);
+  }
+  atm_log.generation++; /* the threads still alive forget their rings */
+  pthread_mutex_unlock(&atm_log.mutex);
+
+  close(atm_log.fd);
+  atm_log.fd = -1;
+  free(atm_log.chunks);
+  atm_log.chunks = NULL;
+}
+
+bool atm_log_active(void) {
+  return atomic_load_explicit(&atm_log.active, memory_order_relaxed);
+}
+
+uint64_t atm_log_dropped(void) {
+  uint64_t dropped;
+
+  pthread_mutex_lock(&atm_log.mutex);
+  dropped = atm_log.dropped;
+  for (struct atm_log_ring *ring = atm_log.rings; NULL != ring;
+       ring = ring->next)
+    dropped += atomic_load(&ring->dropped);
+  pthread_mutex_unlock(&atm_log.mutex);
+  return dropped;
+}
\ No newline at end of file
@@ -31,48 +31,528 @@
  *
  * @see https://linux.die.net/man/3/pthread_mutex_lock
  */
+#define _GNU_SOURCE /*pthread_rwlockattr_setkind_np*/
 #include "threads_banking.h"
+#include "threads_atm_log.h"
+#include "threads_journal.h"
+#include "threads_lock_profile.h"
 
 #include <errno.h>
 #include <stdio.h>  /*streams> fopen, fputs*/
 #include <stdlib.h> /*NULL (stddef)*/
 #include <string.h> /*strerror*/
 
+/* Batches up to this size are grouped without allocating */
+#define WITHDRAW_BATCH_STACK 64U
+/* Leases a thread holds at once, one per account (looked up linearly) */
+#define ACCOUNT_LEASES 8U
+/* A lease covers up to this many withdrawls of the amount that asked it... */
+#define ACCOUNT_LEASE_WITHDRAWLS 16U
+/* ...and never more than this fraction of what is left on the account */
+#define ACCOUNT_LEASE_SHARE 8U
+
 /**
  * Simulate disbursing @param amount on our fictional ATM
+ * (logged asynchronously when the atm log is active)
  */
 void disburse_money(unsigned int amount) {
-  printf("Disbursing $%u from thread %lu\n", amount,
-         (unsigned long int)pthread_self());
+  if (atm_log_active())
+    atm_log_write(ATM_LOG_DISBURSE, amount, NULL);
+  else
+    printf("Disbursing $%u from thread %lu\n", amount,
+           (unsigned long int)pthread_self());
 }
 
 /**
- * Thread safe implementation of withdraw() using mutexes if locktype ask for it
+ * Lock-free withdraw: the balance check and both updates are committed by a
+ * single compare and swap of the packed state, retried when another thread
+ * changed the account in between
  */
-static bool withdraw(account_t *account, unsigned int amount) {
-  bool success = false;
+static bool withdraw_atomic(account_t *account, uint32_t amount) {
+  account_state_t current, updated;
+
+  current.packed = atomic_load_explicit(&account->state, memory_order_relaxed);
+  do {
+    if (current.current_balance < (long)amount)
+      return false;
+    updated.current_balance = current.current_balance - (int32_t)amount;
+    updated.withdrawl_total = current.withdrawl_total + amount;
+  } while (!atomic_compare_exchange_weak_explicit(
+      &account->state, &current.packed, updated.packed, memory_order_acq_rel,
+      memory_order_relaxed));
+  return true;
+}
 
-  if ((ACCOUNT_LOCKING_MUTEX == account->locktype) &&
-      (0 != pthread_mutex_lock(&account->mutex))) {
-    printf("pthread_mutex_lock failed with %s\n", strerror(errno));
+/**
+ * Balance of an account reserved by a thread with ACCOUNT_LOCKING_LEASE
+ */
+struct account_lease {
+  account_t *account; /* NULL when the slot holds no lease */
+  uint32_t remaining; /* reserved and not withdrawn yet */
+  uint32_t used;      /* withdrawn, not added to the withdrawl total yet */
+};
+
+static pthread_key_t account_lease_key;
+static pthread_once_t account_lease_key_once = PTHREAD_ONCE_INIT;
+static __thread struct account_lease account_leases[ACCOUNT_LEASES];
+
+/**
+ * Settles @param lease with its account: the remaining balance goes back,
+ * the used one to the withdrawl total, and a new lease for withdrawls of
+ * @param amount is reserved, all in a single compare and swap. The new
+ * lease is a share of what is left, and at least amount.
+ * @return uint32_t balance reserved, 0 when there wasn't enough (or amount
+ * was 0) and the slot is left empty
+ */
+static uint32_t settle_lease(struct account_lease *lease, uint32_t amount) {
+  account_t *account = lease->account;
+  account_state_t current, updated;
+  uint32_t reserved;
+
+  current.packed = atomic_load_explicit(&account->state, memory_order_relaxed);
+  do {
+    const int64_t available =
+        (int64_t)current.current_balance + lease->remaining;
+    reserved = 0;
+    if ((0 < amount) && (available >= amount)) {
+      reserved = (uint32_t)(available / ACCOUNT_LEASE_SHARE);
+      if ((uint64_t)amount * ACCOUNT_LEASE_WITHDRAWLS < reserved)
+        reserved = amount * ACCOUNT_LEASE_WITHDRAWLS;
+      if (amount > reserved)
+        reserved = amount;
+    }
+    updated.current_balance = (int32_t)(available - reserved);
+    updated.withdrawl_total = current.withdrawl_total + lease->used;
+    if (updated.packed == current.packed) /* a decline only reads the line */
+      break;
+  } while (!atomic_compare_exchange_weak_explicit(
+      &account->state, &current.packed, updated.packed, memory_order_acq_rel,
+      memory_order_relaxed));
+
+  lease->account = (0 < reserved) ? account : NULL;
+  lease->remaining = reserved;
+  lease->used = 0;
+  return reserved;
+}
+
+void account_release_leases(void) {
+  for (unsigned int i = 0; i < ACCOUNT_LEASES; i++)
+    if (NULL != account_leases[i].account)
+      settle_lease(&account_leases[i], 0);
+}
+
+/**
+ * Destructor of the thread specific data: returns the leases of the
+ * exiting thread
+ */
+static void account_lease_thread_exit(void *leases) {
+  (void)leases;
+  account_release_leases();
+}
+
+static void account_lease_create_key(void) {
+  pthread_key_create(&account_lease_key, account_lease_thread_exit);
+}
+
+/**
+ * The lease of @param account held by the calling thread, a free slot when
+ * @param account is NULL
+ * @return NULL when there is none
+ */
+static struct account_lease *lease_find(const account_t *account) {
+  for (unsigned int i = 0; i < ACCOUNT_LEASES; i++)
+    if (account == account_leases[i].account)
+      return &account_leases[i];
+  return NULL;
+}
+
+/**
+ * Withdraw served from the lease of the calling thread: only renewing the
+ * lease writes to the account, once every few withdrawls. With every slot
+ * leased to other accounts it's a plain atomic withdraw, evicting a lease
+ * would cost a compare and swap more than it saves.
+ */
+static bool withdraw_leased(account_t *account, uint32_t amount) {
+  struct account_lease *lease = lease_find(account);
+
+  if (NULL == lease) {
+    if (NULL == (lease = lease_find(NULL)))
+      return withdraw_atomic(account, amount);
+    /* Leases of the thread are returned when it exits */
+    pthread_once(&account_lease_key_once, account_lease_create_key);
+    if (NULL == pthread_getspecific(account_lease_key))
+      pthread_setspecific(account_lease_key, account_leases);
+    lease->account = account;
+  }
+  if ((amount > lease->remaining) && (0 == settle_lease(lease, amount)))
+    return false;
+  lease->remaining -= amount;
+  lease->used += amount;
+  return true;
+}
+
+/**
+ * Takes the lock of @param account as a writer, when its locktype uses one.
+ * While the lock profile is enabled the lock is tried first, so the
+ * contended acquisitions and their wait are recorded.
+ * @return false when the lock failed
+ */
+static bool account_lock(account_t *account) {
+  const bool profiled = lock_profile_enabled();
+  uint64_t wait_begin_ns = 0;
+  int rc = 0;
+
+  if (ACCOUNT_LOCKING_MTX == account->locktype) {
+    rc = profiled ? pthread_mutex_trylock(&account->mutex) : EBUSY;
+    if (EBUSY == rc) {
+      wait_begin_ns = profiled ? lock_profile_now() : 0;
+      rc = pthread_mutex_lock(&account->mutex);
+    }
+    if (0 != rc)
+      printf("pthread_mutex_lock failed with %s\n", strerror(rc));
+  } else if (ACCOUNT_LOCKING_RWLOCK == account->locktype) {
+    rc = profiled ? pthread_rwlock_trywrlock(&account->rwlock) : EBUSY;
+    if (EBUSY == rc) {
+      wait_begin_ns = profiled ? lock_profile_now() : 0;
+      rc = pthread_rwlock_wrlock(&account->rwlock);
+    }
+    if (0 != rc)
+      printf("pthread_rwlock_wrlock failed with %s\n", strerror(rc));
+  } else if (ACCOUNT_LOCKING_SPIN == account->locktype) {
+    if (!profiled || !ticket_trylock(&account->ticket_lock)) {
+      wait_begin_ns = profiled ? lock_profile_now() : 0;
+      ticket_lock(&account->ticket_lock);
+    }
   } else {
-    const int balance = account->current_balance;
-    if (balance >= (long)amount) {
+    return true;
+  }
+  if (profiled && (0 == rc))
+    lock_profile_acquired(account, wait_begin_ns);
+  return (0 == rc);
+}
+
+static bool account_unlock(account_t *account) {
+  int rc = 0;
+
+  if ((ACCOUNT_LOCKING_ATOMIC != account->locktype) &&
+      (ACCOUNT_LOCKING_NON != account->locktype) && lock_profile_enabled())
+    lock_profile_released(account);
+
+  if (ACCOUNT_LOCKING_MTX == account->locktype) {
+    if (0 != (rc = pthread_mutex_unlock(&account->mutex)))
+      printf("pthread_mutex_unlock failed with %s\n", strerror(rc));
+  } else if (ACCOUNT_LOCKING_RWLOCK == account->locktype) {
+    if (0 != (rc = pthread_rwlock_unlock(&account->rwlock)))
+      printf("pthread_rwlock_unlock failed with %s\n", strerror(rc));
+  } else if (ACCOUNT_LOCKING_SPIN == account->locktype) {
+    ticket_unlock(&account->ticket_lock);
+  }
+  return (0 == rc);
+}
+
+/**
+ * The writers of every locktype publish balance and total with a single
+ * store of the packed state, so an inquiry never sees half an update
+ */
+static inline account_state_t load_state(account_t *account) {
+  account_state_t state;
+  state.packed = atomic_load_explicit(&account->state, memory_order_acquire);
+  return state;
+}
+
+static inline void store_state(account_t *account, account_state_t state) {
+  atomic_store_explicit(&account->state, state.packed, memory_order_release);
+}
+
+static bool withdraw_locked(account_t *account, uint32_t amount) {
+  account_state_t state;
+  bool success = false;
+
+  if (account_lock(account)) {
+    state = load_state(account);
+    if (state.current_balance >= (long)amount) {
       success = true;
-      printf("Withdrawl approved\n");
-      account->current_balance = balance - amount;
-      account->withdrawl_total += amount;
+      state.current_balance -= (int32_t)amount;
+      state.withdrawl_total += amount;
+      store_state(account, state);
     }
-    if (((ACCOUNT_LOCKING_MUTEX == account->locktype)) &&
-        (0 != pthread_mutex_unlock(&account->mutex))) {
-      printf("pthread_mutex_unlock failed with %s\n", strerror(errno));
+    if (!account_unlock(account))
       success = false; // not sure if we should give out cash in this case,
                        // error on the safe side...
-    }
+  }
+  return success;
+}
+
+/**
+ * Adds @param amount to the balance of @param account and takes
+ * @param withdrawn off its withdrawl total
+ * @return false when the balance would overflow or the lock failed
+ */
+static bool credit(account_t *account, uint32_t amount, uint32_t withdrawn) {
+  account_state_t current, updated;
+  bool success = false;
+
+  if ((ACCOUNT_LOCKING_ATOMIC == account->locktype) ||
+      (ACCOUNT_LOCKING_LEASE == account->locktype)) {
+    current.packed =
+        atomic_load_explicit(&account->state, memory_order_relaxed);
+    do {
+      if ((int64_t)current.current_balance + amount > INT32_MAX)
+        return false;
+      updated.current_balance = current.current_balance + (int32_t)amount;
+      updated.withdrawl_total = current.withdrawl_total - withdrawn;
+    } while (!atomic_compare_exchange_weak_explicit(
+        &account->state, &current.packed, updated.packed,
+        memory_order_acq_rel, memory_order_relaxed));
+    success = true;
+  } else if (account_lock(account)) {
+    current = load_state(account);
+    success = ((int64_t)current.current_balance + amount <= INT32_MAX);
     if (success) {
-      disburse_money(amount);
+      current.current_balance += (int32_t)amount;
+      current.withdrawl_total -= withdrawn;
+      store_state(account, current);
+    }
+    account_unlock(account);
+  }
+  return success;
+}
+
+/**
+ * Gives back @param amount of a withdrawl that couldn't be journaled
+ */
+static void refund(account_t *account, uint32_t amount) {
+  struct account_lease *lease = NULL;
+
+  if (ACCOUNT_LOCKING_LEASE == account->locktype)
+    lease = lease_find(account);
+  if ((NULL != lease) && (amount <= lease->used)) {
+    /* The withdrawl is still in the lease, and goes back to it */
+    lease->remaining += amount;
+    lease->used -= amount;
+  } else {
+    /* Withdrawn without a lease, or the lease was settled since (renewed
+       or emptied by a decline) and moved the withdrawl to the account */
+    credit(account, amount, amount);
+  }
+}
+
+bool account_deposit(account_t *account, uint32_t amount) {
+  /* The journal only records withdrawls, a replay would miss it */
+  if (NULL != account->journal)
+    return false;
+  return credit(account, amount, 0);
+}
+
+/**
+ * Journals the withdrawl of @param amount and waits for it to be durable,
+ * refunding it when that fails
+ * @return true when journaled
+ */
+static bool journal_withdrawl(account_t *account, uint32_t amount) {
+  uint64_t sequence =
+      journal_append(account->journal, account->journal_id, amount);
+
+  if ((0 != sequence) && journal_commit(account->journal, sequence))
+    return true;
+  refund(account, amount);
+  return false;
+}
+
+/**
+ * Thread safe implementation of withdraw using mutexes, rwlocks, atomics or
+ * leases if locktype ask for it
+ */
+bool account_withdraw(account_t *account, uint32_t amount) {
+  bool success;
+
+  if (ACCOUNT_LOCKING_ATOMIC == account->locktype)
+    success = withdraw_atomic(account, amount);
+  else if (ACCOUNT_LOCKING_LEASE == account->locktype)
+    success = withdraw_leased(account, amount);
+  else
+    success = withdraw_locked(account, amount);
+
+  if (success && (NULL != account->journal))
+    success = journal_withdrawl(account, amount);
+  return success;
+}
+
+account_state_t account_inquiry(account_t *account) {
+  account_state_t state;
+
+  /* Only the rwlock makes inquiries wait, for the running withdrawl */
+  if ((ACCOUNT_LOCKING_RWLOCK == account->locktype) &&
+      (0 == pthread_rwlock_rdlock(&account->rwlock))) {
+    state = load_state(account);
+    pthread_rwlock_unlock(&account->rwlock);
+  } else {
+    state = load_state(account);
+  }
+  return state;
+}
+
+/**
+ * A request of a batch, with its account to sort by it
+ */
+struct batch_entry {
+  uintptr_t account;
+  size_t index;
+};
+
+/**
+ * Orders by account, then by position in the batch
+ */
+static int compare_entries(const void *a, const void *b) {
+  const struct batch_entry *left = a, *right = b;
+
+  if (left->account != right->account)
+    return (left->account < right->account) ? -1 : 1;
+  return (left->index < right->index) ? -1 : (left->index > right->index);
+}
+
+/**
+ * Decides the @param count requests of @param group (all on the same
+ * account) against @param state, updating it
+ * @return size_t amount approved
+ */
+static size_t apply_group(withdraw_request_t *requests,
+                          const struct batch_entry *group, size_t count,
+                          account_state_t *state) {
+  size_t approved = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    withdraw_request_t *request = &requests[group[i].index];
+    request->approved = (state->current_balance >= (long)request->amount);
+    if (request->approved) {
+      state->current_balance -= (int32_t)request->amount;
+      state->withdrawl_total += request->amount;
+      approved++;
     }
   }
+  return approved;
+}
+
+/**
+ * Journals the approved requests of @param group with a single commit,
+ * refunding them when that fails
+ * @return size_t amount that stay approved
+ */
+static size_t journal_group(withdraw_request_t *requests,
+                            const struct batch_entry *group, size_t count) {
+  account_t *account = requests[group[0].index].account;
+  uint64_t sequence = 0;
+  size_t approved = 0;
+  bool journaled = true;
+
+  for (size_t i = 0; journaled && (i < count); i++)
+    if (requests[group[i].index].approved) {
+      sequence = journal_append(account->journal, account->journal_id,
+                                requests[group[i].index].amount);
+      journaled = (0 != sequence);
+    }
+  journaled = journaled && journal_commit(account->journal, sequence);
+
+  for (size_t i = 0; i < count; i++) {
+    withdraw_request_t *request = &requests[group[i].index];
+    if (request->approved && !journaled) {
+      refund(account, request->amount);
+      request->approved = false;
+    }
+    approved += request->approved;
+  }
+  return approved;
+}
+
+static size_t withdraw_group(withdraw_request_t *requests,
+                             const struct batch_entry *group, size_t count) {
+  account_t *account = requests[group[0].index].account;
+  account_state_t current, updated;
+  size_t approved = 0;
+
+  if (ACCOUNT_LOCKING_LEASE == account->locktype) {
+    /* Served by the lease, no need to group them */
+    for (size_t i = 0; i < count; i++) {
+      withdraw_request_t *request = &requests[group[i].index];
+      request->approved = withdraw_leased(account, request->amount);
+      approved += request->approved;
+    }
+  } else if (ACCOUNT_LOCKING_ATOMIC == account->locktype) {
+    /* The whole group is committed by one compare and swap */
+    current.packed =
+        atomic_load_explicit(&account->state, memory_order_relaxed);
+    do {
+      updated = current;
+      approved = apply_group(requests, group, count, &updated);
+    } while (!atomic_compare_exchange_weak_explicit(
+        &account->state, &current.packed, updated.packed,
+        memory_order_acq_rel, memory_order_relaxed));
+  } else if (!account_lock(account)) {
+    for (size_t i = 0; i < count; i++)
+      requests[group[i].index].approved = false;
+  } else {
+    current = load_state(account);
+    approved = apply_group(requests, group, count, &current);
+    store_state(account, current);
+    account_unlock(account);
+  }
+
+  if ((0 < approved) && (NULL != account->journal))
+    approved = journal_group(requests, group, count);
+  return approved;
+}
+
+size_t withdraw_batch(withdraw_request_t *requests, size_t count) {
+  struct batch_entry stack_entries[WITHDRAW_BATCH_STACK];
+  struct batch_entry *entries = stack_entries;
+  size_t approved = 0;
+  bool sorted = true;
+
+  if (0 == count)
+    return 0;
+  if (WITHDRAW_BATCH_STACK < count) {
+    entries = (struct batch_entry *)malloc(count * sizeof(*entries));
+    if (NULL == entries) {
+      printf("Memory allocation for a batch of %zu failed\n", count);
+      for (size_t i = 0; i < count; i++)
+        requests[i].approved = false;
+      return 0;
+    }
+  }
+  for (size_t i = 0; i < count; i++) {
+    entries[i].account = (uintptr_t)requests[i].account;
+    entries[i].index = i;
+    sorted &= (0 == i) || (entries[i - 1].account <= entries[i].account);
+  }
+  if (!sorted) /* batches already grouped by account skip the sort */
+    qsort(entries, count, sizeof(*entries), compare_entries);
+
+  for (size_t first = 0, last; first < count; first = last) {
+    for (last = first + 1;
+         (last < count) && (entries[last].account == entries[first].account);
+         last++)
+      ;
+    approved += withdraw_group(requests, entries + first, last - first);
+  }
+
+  if (stack_entries != entries)
+    free(entries);
+  return approved;
+}
+
+/**
+ * Verbose withdraw() of the ATM demo, disburses the approved withdrawls
+ */
+static bool withdraw(account_t *account, unsigned int amount) {
+  bool success = account_withdraw(account, amount);
+
+  if (success) {
+    if (atm_log_active())
+      atm_log_write(ATM_LOG_APPROVED, amount, NULL);
+    else
+      printf("Withdrawl approved\n");
+    disburse_money(amount);
+  }
   return success;
 }
 
@@ -86,6 +566,7 @@ bool withdraw_account_init(account_t *account,
                            withdraw_locking_t locktype) {
   int rc = 0;
   bool success = true;
+  pthread_rwlockattr_t attr;
   memset(account, 0, sizeof(account_t));
   account->current_balance = starting_balance;
   account->locktype = locktype;
@@ -94,6 +575,17 @@ bool withdraw_account_init(account_t *account,
     printf("Failed to initialize account mutex, error was %d", rc);
     success = false;
   }
+  /* Inquiries outnumber withdrawls, a reader preferring lock starves them */
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setkind_np(&attr,
+                                PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  rc = pthread_rwlock_init(&account->rwlock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+  if (rc != 0) {
+    printf("Failed to initialize account rwlock, error was %d", rc);
+    success = false;
+  }
+  ticket_lock_init(&account->ticket_lock);
   return success;
 }
 
@@ -102,10 +594,42 @@ bool withdraw_account_init(account_t *account,
  * in @param withdraw_request increments until the account does not have
  * enough remaining to complete the withdrawl Assumes the @param account
  * structure has been previously initialized with "withdraw_account_init"
+ * Every approved withdrawl is written to the atm-log of @param key
  */
-void do_withdrawls(struct account *account, unsigned int withdraw_request) {
-  bool withdraw_success = false;
-  do {
-    withdraw_success = withdraw(account, withdraw_request);
-  } while (withdraw_success);
+uint32_t do_withdrawls(account_t *account, uint32_t withdraw_request,
+                       uint32_t *key) {
+  char message[64u];
+  uint32_t total = 0;
+
+  while (withdraw(account, withdraw_request)) {
+    total += withdraw_request;
+    snprintf(message, sizeof(message), "Withdrawl $%u approved, total $%u",
+             withdraw_request, total);
+    write_atm_log(message, key);
+  }
+  return total;
+}
+
+/**
+ * Write @param message as a line of the log stored under @param key, or to
+ * the asynchronous atm log when it's active
+ */
+void write_atm_log(const char *message, uint32_t *key) {
+  FILE *thread_log;
+
+  if (atm_log_active()) {
+    atm_log_write(ATM_LOG_MESSAGE, 0, message);
+  } else {
+    thread_log = (FILE *)pthread_getspecific((pthread_key_t)*key);
+    if (NULL != thread_log)
+      fprintf(thread_log, "%s\n", message);
+  }
+}
+
+/**
+ * Destructor of the thread specific log, @param thread_log is its FILE *
+ */
+void close_atm_log(void *thread_log) {
+  if (NULL != thread_log)
+    fclose((FILE *)thread_log);
 }
\ No newline at end of file
@@ -0,0 +1,324 @@
+/*******************************************************************************
+ * Copyright (C) 2023 by Salvador Z                                            *
+ *                                                                             *
+ * This file is part of ELSU                                                   *
+ *                                                                             *
+ *   Permission is hereby granted, free of charge, to any person obtaining a   *
+ *   copy of this software and associated documentation files (the Software)   *
+ *   to deal in the Software without restriction including without limitation  *
+ *   the rights to use, copy, modify, merge, publish, distribute, sublicense,  *
+ *   and/or sell copies ot the Software, and to permit persons to whom the     *
+ *   Software is furnished to do so, subject to the following conditions:      *
+ *                                                                             *
+ *   The above copyright notice and this permission notice shall be included   *
+ *   in all copies or substantial portions of the Software.                    *
+ *                                                                             *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS   *
+ *   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARANTIES OF MERCHANTABILITY *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL   *
+ *   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR      *
+ *   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,     *
+ *   ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE        *
+ *   OR OTHER DEALINGS IN THE SOFTWARE.                                        *
+ ******************************************************************************/
+
+/**
+ * @file journal.c
+ * @author Salvador Z
+ * @date 17 Oct 2026
+ * @brief File for making the approved withdrawls survive a crash
+ *
+ * Appending only copies the record into a memory buffer. Durability comes
+ * from group commit: the first thread waiting for its record becomes the
+ * leader, takes every pending record, writes them with a single `write` and
+ * calls `fdatasync` once; the threads arriving meanwhile wait for it and
+ * the next leader commits all of them together. The cost of the sync is
+ * shared by every record of the group instead of paid by each one. When a
+ * commit fails the file is cut back to its last durable size, so it never
+ * keeps records of withdrawls the callers refund.
+ *
+ * @see https://man7.org/linux/man-pages/man2/fdatasync.2.html
+ */
+
+#include "threads_journal.h"
+
+#include <errno.h>
+#include <fcntl.h>  /*open*/
+#include <pthread.h>
+#include <stdio.h>  /*printf*/
+#include <stdlib.h> /*malloc, realloc, free*/
+#include <string.h> /*memcpy, strerror*/
+#include <unistd.h> /*read, write, fdatasync, ftruncate, usleep*/
+
+#define JOURNAL_MAGIC 0x4C4E524AU /* "JRNL" */
+/* Records the pending buffer starts with, it grows as needed */
+#define JOURNAL_BUFFER_RECORDS 1024U
+
+/**
+ * A record on disk
+ */
+struct journal_record {
+  uint32_t magic;
+  uint32_t account;
+  uint64_t sequence;
+  uint32_t amount;
+  uint32_t checksum; /* FNV-1a of the fields above */
+};
+
+struct journal_buffer {
+  struct journal_record *records;
+  size_t count;
+  size_t size;
+};
+
+struct journal {
+  pthread_mutex_t mutex;
+  pthread_cond_t committed;
+  int fd;
+  unsigned int window_us;
+  struct journal_buffer pending; /* appended, not written yet */
+  struct journal_buffer writing; /* owned by the leader while committing */
+  uint64_t last_sequence;        /* of the last record appended */
+  uint64_t durable_sequence;     /* every record up to it is on disk */
+  off_t durable_size;            /* size of the file up to that record */
+  bool committing;               /* there is a leader */
+  bool failed;                   /* a write or a sync failed */
+  journal_stats_t stats;
+};
+
+static uint32_t record_checksum(const struct journal_record *record) {
+  const unsigned char *bytes = (const unsigned char *)record;
+  uint32_t hash = 2166136261U;
+
+  for (size_t i = 0; i < offsetof(struct journal_record, checksum); i++)
+    hash = (hash ^ bytes[i]) * 16777619U;
+  return hash;
+}
+
+static bool record_valid(const struct journal_record *record) {
+  return (JOURNAL_MAGIC == record->magic) &&
+         (record_checksum(record) == record->checksum);
+}
+
+/**
+ * Reads the next record of @param fd
+ * @return ssize_t bytes read, less than a record only at the end of the
+ * file, -1 on error
+ */
+static ssize_t read_record(int fd, struct journal_record *record) {
+  size_t done = 0;
+
+  while (done < sizeof(*record)) {
+    ssize_t rd_bytes = read(fd, (char *)record + done, sizeof(*record) - done);
+    if (0 < rd_bytes)
+      done += (size_t)rd_bytes;
+    else if (0 == rd_bytes)
+      break;
+    else if (EINTR != errno)
+      return -1;
+  }
+  return (ssize_t)done;
+}
+
+static bool write_full(int fd, const void *data, size_t length) {
+  const char *bytes = (const char *)data;
+
+  while (0 < length) {
+    ssize_t wr_bytes = write(fd, bytes, length);
+    if (-1 == wr_bytes) {
+      if (EINTR == errno)
+        continue;
+      return false;
+    }
+    bytes += wr_bytes;
+    length -= (size_t)wr_bytes;
+  }
+  return true;
+}
+
+journal_t *journal_open(const char *path, unsigned int window_us) {
+  journal_t *journal = (journal_t *)calloc(1, sizeof(journal_t));
+  struct journal_record record;
+  off_t valid = 0;
+  ssize_t rd_bytes;
+
+  if (NULL == journal)
+    return NULL;
+  pthread_mutex_init(&journal->mutex, NULL);
+  pthread_cond_init(&journal->committed, NULL);
+  journal->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  journal->pending.size = JOURNAL_BUFFER_RECORDS;
+  journal->pending.records = (struct journal_record *)malloc(
+      JOURNAL_BUFFER_RECORDS * sizeof(struct journal_record));
+  if ((-1 == journal->fd) || (NULL == journal->pending.records)) {
+    printf("Failed to open the journal %s: %s\n", path, strerror(errno));
+    journal_close(journal);
+    return NULL;
+  }
+
+  while ((ssize_t)sizeof(record) ==
+             (rd_bytes = read_record(journal->fd, &record)) &&
+         record_valid(&record)) {
+    journal->last_sequence = record.sequence;
+    valid += (off_t)sizeof(record);
+  }
+  if ((ssize_t)sizeof(record) == rd_bytes) {
+    /* A whole record that doesn't check, the records after it would be
+       lost by cutting it: better leave the file to be looked at */
+    printf("The journal %s is corrupted at offset %lld\n", path,
+           (long long)valid);
+    journal_close(journal);
+    return NULL;
+  }
+  if (-1 == rd_bytes) {
+    printf("Failed to read the journal %s: %s\n", path, strerror(errno));
+    journal_close(journal);
+    return NULL;
+  }
+  /* Less than a record left, a write torn by a crash */
+  if ((0 < rd_bytes) &&
+      ((0 != ftruncate(journal->fd, valid)) || (0 != fdatasync(journal->fd)))) {
+    printf("Failed to cut the torn end of %s: %s\n", path, strerror(errno));
+    journal_close(journal);
+    return NULL;
+  }
+
+  journal->durable_sequence = journal->last_sequence;
+  journal->durable_size = valid;
+  journal->window_us = window_us;
+  return journal;
+}
+
+void journal_close(journal_t *journal) {
+  if (NULL == journal)
+    return;
+  if (-1 != journal->fd) {
+    journal_commit(journal, journal->last_sequence);
+    close(journal->fd);
+  }
+  pthread_cond_destroy(&journal->committed);
+  pthread_mutex_destroy(&journal->mutex);
+  free(journal->pending.records);
+  free(journal->writing.records);
+  free(journal);
+}
+
+size_t journal_replay(journal_t *journal, account_t **accounts, size_t count) {
+  struct journal_record record;
+  size_t applied = 0;
+
+  pthread_mutex_lock(&journal->mutex);
+  lseek(journal->fd, 0, SEEK_SET); /* O_APPEND still writes at the end */
+  while (((ssize_t)sizeof(record) == read_record(journal->fd, &record)) &&
+         record_valid(&record)) {
+    if ((record.account >= count) || (NULL == accounts[record.account]))
+      continue;
+    account_t *account = accounts[record.account];
+    /* Withdrawls commute, the order they were journaled doesn't matter */
+    account->current_balance -= (int32_t)record.amount;
+    account->withdrawl_total += record.amount;
+    applied++;
+  }
+  pthread_mutex_unlock(&journal->mutex);
+  return applied;
+}
+
+uint64_t journal_append(journal_t *journal, uint32_t account_id,
+                        uint32_t amount) {
+  struct journal_buffer *pending = &journal->pending;
+  uint64_t sequence = 0;
+
+  pthread_mutex_lock(&journal->mutex);
+  if (pending->count == pending->size) {
+    struct journal_record *grown = (struct journal_record *)realloc(
+        pending->records, 2 * pending->size * sizeof(struct journal_record));
+    if (NULL != grown) {
+      pending->records = grown;
+      pending->size *= 2;
+    }
+  }
+  if ((pending->count < pending->size) && !journal->failed) {
+    struct journal_record *record = &pending->records[pending->count++];
+    sequence = ++journal->last_sequence;
+    record->magic = JOURNAL_MAGIC;
+    record->account = account_id;
+    record->sequence = sequence;
+    record->amount = amount;
+    record->checksum = record_checksum(record);
+    journal->stats.records++;
+  }
+  pthread_mutex_unlock(&journal->mutex);
+  return sequence;
+}
+
+bool journal_commit(journal_t *journal, uint64_t sequence) {
+  bool durable;
+
+  pthread_mutex_lock(&journal->mutex);
+  while ((journal->durable_sequence < sequence) && !journal->failed) {
+    if (journal->committing) { /* follower, the leader may cover us */
+      pthread_cond_wait(&journal->committed, &journal->mutex);
+      continue;
+    }
+    journal->committing = true;
+    if (0 < journal->window_us) { /* let more records join the group */
+      pthread_mutex_unlock(&journal->mutex);
+      usleep(journal->window_us);
+      pthread_mutex_lock(&journal->mutex);
+    }
+    /* Take the pending records, appends go to the other buffer meanwhile */
+    struct journal_buffer group = journal->pending;
+    journal->pending = journal->writing;
+    journal->writing = (struct journal_buffer){NULL, 0, 0};
+    if (NULL == journal->pending.records) {
+      journal->pending.records = (struct journal_record *)malloc(
+          JOURNAL_BUFFER_RECORDS * sizeof(struct journal_record));
+      journal->pending.size =
+          (NULL != journal->pending.records) ? JOURNAL_BUFFER_RECORDS : 0;
+    }
+    journal->pending.count = 0;
+    const uint64_t group_sequence = journal->last_sequence;
+    pthread_mutex_unlock(&journal->mutex);
+
+    const off_t group_size =
+        (off_t)(group.count * sizeof(struct journal_record));
+    bool written = write_full(journal->fd, group.records, (size_t)group_size) &&
+                   (0 == fdatasync(journal->fd));
+    if (!written) {
+      printf("Journal commit failed with %s\n", strerror(errno));
+      /* Part of the group may be in the file, its callers are refunded:
+         drop it so a replay doesn't apply them */
+      if ((0 != ftruncate(journal->fd, journal->durable_size)) ||
+          (0 != fdatasync(journal->fd)))
+        printf("Failed to cut the journal back, it may hold refunded "
+               "withdrawls: %s\n", strerror(errno));
+    }
+
+    pthread_mutex_lock(&journal->mutex);
+    group.count = 0;
+    journal->writing = group; /* reused by the next leader */
+    journal->failed |= !written;
+    if (written) {
+      journal->durable_sequence = group_sequence;
+      journal->durable_size += group_size;
+    }
+    journal->stats.commits++;
+    journal->committing = false;
+    pthread_cond_broadcast(&journal->committed);
+  }
+  durable = (journal->durable_sequence >= sequence);
+  pthread_mutex_unlock(&journal->mutex);
+  return durable;
+}
+
+void journal_get_stats(journal_t *journal, journal_stats_t *stats) {
+  pthread_mutex_lock(&journal->mutex);
+  *stats = journal->stats;
+  pthread_mutex_unlock(&journal->mutex);
+}
+
+void account_attach_journal(account_t *account, journal_t *journal,
+                            uint32_t id) {
+  account->journal = journal;
+  account->journal_id = id;
+}
\ No newline at end of file
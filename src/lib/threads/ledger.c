@@ -0,0 +1,224 @@
+/*******************************************************************************
+ * Copyright (C) 2023 by Salvador Z                                            *
+ *                                                                             *
+ * This file is part of ELSU                                                   *
+ *                                                                             *
+ *   Permission is hereby granted, free of charge, to any person obtaining a   *
+ *   copy of this software and associated documentation files (the Software)   *
+ *   to deal in the Software without restriction including without limitation  *
+ *   the rights to use, copy, modify, merge, publish, distribute, sublicense,  *
+ *   and/or sell copies ot the Software, and to permit persons to whom the     *
+ *   Software is furnished to do so, subject to the following conditions:      *
+ *                                                                             *
+ *   The above copyright notice and this permission notice shall be included   *
+ *   in all copies or substantial portions of the Software.                    *
+ *                                                                             *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS   *
+ *   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARANTIES OF MERCHANTABILITY *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL   *
+ *   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR      *
+ *   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,     *
+ *   ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE        *
+ *   OR OTHER DEALINGS IN THE SOFTWARE.                                        *
+ ******************************************************************************/
+
+/**
+ * @file ledger.c
+ * @author Salvador Z
+ * @date 17 Oct 2026
+ * @brief File for a ledger of many accounts shared by many threads
+ *
+ * Instead of a single mutex every account has its own spinlock, living in
+ * the same cache line as the data it protects (and alone in that line), so
+ * threads only contend when they really touch the same account. The ids are
+ * striped across the shards (id modulo the amount of shards), each shard a
+ * separate cache line aligned array.
+ *
+ * @see https://en.wikipedia.org/wiki/Test_and_test-and-set
+ */
+
+#include "threads_ledger.h"
+
+#include <sched.h>  /*sched_yield*/
+#include <stdio.h>  /*printf*/
+#include <stdlib.h> /*aligned_alloc, calloc, free*/
+
+/* Accounts per shard when the amount of shards is not given */
+#define LEDGER_SHARD_ACCOUNTS (64U * 1024U)
+/* Busy waits on a taken lock before giving the CPU away */
+#define LEDGER_SPINS_BEFORE_YIELD 128U
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ledger_cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define ledger_cpu_relax() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define ledger_cpu_relax() ((void)0)
+#endif
+
+struct ledger_shard {
+  ledger_account_t *accounts;
+  size_t count;
+};
+
+struct ledger {
+  size_t size;
+  size_t shard_mask; /* shards - 1, a power of two */
+  unsigned int shard_bits;
+  struct ledger_shard *shards;
+};
+
+static inline void ledger_lock(ledger_account_t *account) {
+  unsigned int spins = 0;
+
+  while (atomic_exchange_explicit(&account->lock, 1U, memory_order_acquire))
+    /* Spin reading, the line stays shared until the owner releases it */
+    while (atomic_load_explicit(&account->lock, memory_order_relaxed)) {
+      if (++spins < LEDGER_SPINS_BEFORE_YIELD) {
+        ledger_cpu_relax();
+      } else { /* the owner may be preempted */
+        spins = 0;
+        sched_yield();
+      }
+    }
+}
+
+static inline void ledger_unlock(ledger_account_t *account) {
+  atomic_store_explicit(&account->lock, 0U, memory_order_release);
+}
+
+ledger_t *ledger_create(size_t accounts, size_t shards,
+                        int64_t starting_balance) {
+  ledger_t *ledger = (ledger_t *)calloc(1, sizeof(ledger_t));
+  size_t wanted = shards;
+
+  if ((NULL == ledger) || (0 == accounts) || (UINT32_MAX < accounts - 1U)) {
+    free(ledger);
+    return NULL;
+  }
+  if (0 == wanted)
+    wanted = (accounts + LEDGER_SHARD_ACCOUNTS - 1U) / LEDGER_SHARD_ACCOUNTS;
+  for (shards = 1; shards < wanted; shards <<= 1)
+    ledger->shard_bits++;
+
+  ledger->size = accounts;
+  ledger->shard_mask = shards - 1U;
+  ledger->shards =
+      (struct ledger_shard *)calloc(shards, sizeof(struct ledger_shard));
+  if (NULL == ledger->shards) {
+    free(ledger);
+    return NULL;
+  }
+
+  for (size_t s = 0; s < shards; s++) {
+    struct ledger_shard *shard = &ledger->shards[s];
+    shard->count = (accounts > s) ? (accounts - s + shards - 1U) / shards : 0;
+    if (0 == shard->count)
+      continue;
+    shard->accounts = (ledger_account_t *)aligned_alloc(
+        LEDGER_CACHE_LINE, shard->count * sizeof(ledger_account_t));
+    if (NULL == shard->accounts) {
+      printf("Failed to allocate %zu accounts of the ledger\n", shard->count);
+      ledger_destroy(ledger);
+      return NULL;
+    }
+    for (size_t i = 0; i < shard->count; i++) {
+      atomic_init(&shard->accounts[i].lock, 0U);
+      shard->accounts[i].balance = starting_balance;
+      shard->accounts[i].withdrawl_total = 0;
+    }
+  }
+  return ledger;
+}
+
+void ledger_destroy(ledger_t *ledger) {
+  if (NULL == ledger)
+    return;
+  for (size_t s = 0; s <= ledger->shard_mask; s++)
+    free(ledger->shards[s].accounts);
+  free(ledger->shards);
+  free(ledger);
+}
+
+size_t ledger_size(const ledger_t *ledger) { return ledger->size; }
+
+ledger_account_t *ledger_account(ledger_t *ledger, ledger_id_t id) {
+  if (id >= ledger->size)
+    return NULL;
+  return &ledger->shards[id & ledger->shard_mask]
+              .accounts[id >> ledger->shard_bits];
+}
+
+bool ledger_withdraw(ledger_t *ledger, ledger_id_t id, uint32_t amount) {
+  ledger_account_t *account = ledger_account(ledger, id);
+  bool success = false;
+
+  if (NULL != account) {
+    ledger_lock(account);
+    if (account->balance >= (int64_t)amount) {
+      account->balance -= amount;
+      account->withdrawl_total += amount;
+      success = true;
+    }
+    ledger_unlock(account);
+  }
+  return success;
+}
+
+bool ledger_deposit(ledger_t *ledger, ledger_id_t id, uint32_t amount) {
+  ledger_account_t *account = ledger_account(ledger, id);
+
+  if (NULL != account) {
+    ledger_lock(account);
+    account->balance += amount;
+    ledger_unlock(account);
+  }
+  return (NULL != account);
+}
+
+bool ledger_transfer(ledger_t *ledger, ledger_id_t from, ledger_id_t to,
+                     uint32_t amount) {
+  ledger_account_t *source = ledger_account(ledger, from);
+  ledger_account_t *target = ledger_account(ledger, to);
+  bool success = false;
+
+  if ((NULL == source) || (NULL == target))
+    return false;
+  if (source == target) /* nothing moves, only the funds are checked */
+    return ledger_balance(ledger, from) >= (int64_t)amount;
+
+  /* A global order (lowest id first) makes a cycle of waiters impossible */
+  ledger_account_t *first = (from < to) ? source : target;
+  ledger_account_t *second = (from < to) ? target : source;
+  ledger_lock(first);
+  ledger_lock(second);
+  if (source->balance >= (int64_t)amount) {
+    source->balance -= amount;
+    source->withdrawl_total += amount;
+    target->balance += amount;
+    success = true;
+  }
+  ledger_unlock(second);
+  ledger_unlock(first);
+  return success;
+}
+
+int64_t ledger_balance(ledger_t *ledger, ledger_id_t id) {
+  ledger_account_t *account = ledger_account(ledger, id);
+  int64_t balance = 0;
+
+  if (NULL != account) {
+    ledger_lock(account);
+    balance = account->balance;
+    ledger_unlock(account);
+  }
+  return balance;
+}
+
+int64_t ledger_total(ledger_t *ledger) {
+  int64_t total = 0;
+
+  for (size_t id = 0; id < ledger->size; id++)
+    total += ledger_balance(ledger, (ledger_id_t)id);
+  return total;
+}
\ No newline at end of file
@@ -0,0 +1,304 @@
+/*******************************************************************************
+ * Copyright (C) 2023 by Salvador Z                                            *
+ *                                                                             *
+ * This file is part of ELSU                                                   *
+ *                                                                             *
+ *   Permission is hereby granted, free of charge, to any person obtaining a   *
+ *   copy of this software and associated documentation files (the Software)   *
+ *   to deal in the Software without restriction including without limitation  *
+ *   the rights to use, copy, modify, merge, publish, distribute, sublicense,  *
+ *   and/or sell copies ot the Software, and to permit persons to whom the     *
+ *   Software is furnished to do so, subject to the following conditions:      *
+ *                                                                             *
+ *   The above copyright notice and this permission notice shall be included   *
+ *   in all copies or substantial portions of the Software.                    *
+ *                                                                             *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS   *
+ *   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARANTIES OF MERCHANTABILITY *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL   *
+ *   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR      *
+ *   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,     *
+ *   ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE        *
+ *   OR OTHER DEALINGS IN THE SOFTWARE.                                        *
+ ******************************************************************************/
+
+/**
+ * @file lock_profile.c
+ * @author Salvador Z
+ * @date 17 Oct 2026
+ * @brief File for measuring how much the threads wait on the account locks
+ *
+ * Every thread counts on its own table, created the first time it takes an
+ * instrumented lock, so the hot path only touches memory of the thread: no
+ * shared atomic nor cache line bouncing between the threads being measured.
+ * A lock is first tried without blocking, a failure means contention and the
+ * wait is timed until the blocking acquisition returns. The tables are
+ * merged when reporting; the one of an exiting thread is merged into the
+ * retired counters by the destructor of its thread specific data.
+ *
+ * @see https://man7.org/linux/man-pages/man3/pthread_mutex_trylock.3p.html
+ */
+
+#include "threads_lock_profile.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h> /*calloc, free*/
+#include <string.h> /*memset*/
+#include <time.h>   /*clock_gettime*/
+
+/* Locks a thread counts apart, the rest share the other entry */
+#define LOCK_PROFILE_LOCKS 8U
+
+struct lock_profile_entry {
+  const void *lock; /* NULL while unused */
+  uint64_t acquired_ns;
+  lock_profile_stats_t stats;
+};
+
+struct lock_profile_table {
+  struct lock_profile_entry entries[LOCK_PROFILE_LOCKS];
+  struct lock_profile_entry other;
+};
+
+struct lock_profile_thread {
+  struct lock_profile_table table;
+  struct lock_profile_thread *next;
+};
+
+static struct {
+  pthread_mutex_t mutex; /* threads, retired */
+  struct lock_profile_thread *threads;
+  struct lock_profile_table retired; /* of the threads that exited */
+  atomic_bool enabled;
+} lock_profile = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static pthread_key_t lock_profile_key;
+static pthread_once_t lock_profile_key_once = PTHREAD_ONCE_INIT;
+static __thread struct lock_profile_thread *lock_profile_self;
+
+static unsigned int histogram_bucket(uint64_t ns) {
+  unsigned int bucket =
+      (0 == ns) ? 0U : 63U - (unsigned int)__builtin_clzll(ns);
+  return (bucket < LOCK_PROFILE_BUCKETS) ? bucket : LOCK_PROFILE_BUCKETS - 1U;
+}
+
+/**
+ * The entry of @param lock in @param table, the other entry when full
+ */
+static struct lock_profile_entry *table_entry(struct lock_profile_table *table,
+                                              const void *lock) {
+  for (unsigned int i = 0; i < LOCK_PROFILE_LOCKS; i++) {
+    if (table->entries[i].lock == lock)
+      return &table->entries[i];
+    if (NULL == table->entries[i].lock) {
+      table->entries[i].lock = lock;
+      return &table->entries[i];
+    }
+  }
+  return &table->other;
+}
+
+static void merge_stats(lock_profile_stats_t *to,
+                        const lock_profile_stats_t *from) {
+  to->acquisitions += from->acquisitions;
+  to->trylock_failures += from->trylock_failures;
+  to->wait_ns += from->wait_ns;
+  to->hold_ns += from->hold_ns;
+  if (from->max_wait_ns > to->max_wait_ns)
+    to->max_wait_ns = from->max_wait_ns;
+  if (from->max_hold_ns > to->max_hold_ns)
+    to->max_hold_ns = from->max_hold_ns;
+  for (unsigned int b = 0; b < LOCK_PROFILE_BUCKETS; b++) {
+    to->wait_histogram[b] += from->wait_histogram[b];
+    to->hold_histogram[b] += from->hold_histogram[b];
+  }
+}
+
+static void merge_table(struct lock_profile_table *to,
+                        const struct lock_profile_table *from) {
+  for (unsigned int i = 0;
+       (i < LOCK_PROFILE_LOCKS) && (NULL != from->entries[i].lock); i++)
+    merge_stats(&table_entry(to, from->entries[i].lock)->stats,
+                &from->entries[i].stats);
+  merge_stats(&to->other.stats, &from->other.stats);
+}
+
+/**
+ * Destructor of the thread specific data: moves the counters of the exiting
+ * thread to the retired ones
+ */
+static void lock_profile_thread_exit(void *self) {
+  struct lock_profile_thread *thread = (struct lock_profile_thread *)self;
+  struct lock_profile_thread **link;
+
+  pthread_mutex_lock(&lock_profile.mutex);
+  merge_table(&lock_profile.retired, &thread->table);
+  for (link = &lock_profile.threads; *link != thread; link = &(*link)->next)
+    ;
+  *link = thread->next;
+  pthread_mutex_unlock(&lock_profile.mutex);
+  free(thread);
+}
+
+static void lock_profile_create_key(void) {
+  pthread_key_create(&lock_profile_key, lock_profile_thread_exit);
+}
+
+/**
+ * The table of the calling thread, created on its first acquisition
+ */
+static struct lock_profile_table *thread_table(void) {
+  struct lock_profile_thread *thread = lock_profile_self;
+
+  if (NULL != thread)
+    return &thread->table;
+
+  pthread_once(&lock_profile_key_once, lock_profile_create_key);
+  thread = (struct lock_profile_thread *)calloc(1, sizeof(*thread));
+  if (NULL == thread)
+    return NULL;
+  pthread_mutex_lock(&lock_profile.mutex);
+  thread->next = lock_profile.threads;
+  lock_profile.threads = thread;
+  pthread_mutex_unlock(&lock_profile.mutex);
+  pthread_setspecific(lock_profile_key, thread);
+  lock_profile_self = thread;
+  return &thread->table;
+}
+
+void lock_profile_enable(bool enable) {
+  atomic_store_explicit(&lock_profile.enabled, enable, memory_order_relaxed);
+}
+
+bool lock_profile_enabled(void) {
+  return atomic_load_explicit(&lock_profile.enabled, memory_order_relaxed);
+}
+
+uint64_t lock_profile_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void lock_profile_acquired(const void *lock, uint64_t wait_begin_ns) {
+  struct lock_profile_table *table = thread_table();
+  const uint64_t now = lock_profile_now();
+  uint64_t wait_ns = 0;
+
+  if (NULL == table)
+    return;
+  struct lock_profile_entry *entry = table_entry(table, lock);
+  if (0 != wait_begin_ns) {
+    wait_ns = now - wait_begin_ns;
+    entry->stats.trylock_failures++;
+  }
+  entry->stats.acquisitions++;
+  entry->stats.wait_ns += wait_ns;
+  if (wait_ns > entry->stats.max_wait_ns)
+    entry->stats.max_wait_ns = wait_ns;
+  entry->stats.wait_histogram[histogram_bucket(wait_ns)]++;
+  entry->acquired_ns = now;
+}
+
+void lock_profile_released(const void *lock) {
+  struct lock_profile_table *table = thread_table();
+  struct lock_profile_entry *entry;
+
+  /* Skipped when profiling was turned on while the lock was held */
+  if ((NULL == table) ||
+      (0 == (entry = table_entry(table, lock))->acquired_ns))
+    return;
+  const uint64_t hold_ns = lock_profile_now() - entry->acquired_ns;
+  entry->acquired_ns = 0;
+  entry->stats.hold_ns += hold_ns;
+  if (hold_ns > entry->stats.max_hold_ns)
+    entry->stats.max_hold_ns = hold_ns;
+  entry->stats.hold_histogram[histogram_bucket(hold_ns)]++;
+}
+
+/**
+ * Merges the retired counters and the ones of the running threads into
+ * @param merged, with the mutex taken
+ */
+static void collect(struct lock_profile_table *merged) {
+  memset(merged, 0, sizeof(*merged));
+  merge_table(merged, &lock_profile.retired);
+  for (struct lock_profile_thread *thread = lock_profile.threads;
+       NULL != thread; thread = thread->next)
+    merge_table(merged, &thread->table);
+}
+
+bool lock_profile_get(const void *lock, lock_profile_stats_t *stats) {
+  struct lock_profile_table merged;
+  bool found = false;
+
+  pthread_mutex_lock(&lock_profile.mutex);
+  collect(&merged);
+  pthread_mutex_unlock(&lock_profile.mutex);
+  for (unsigned int i = 0; !found && (i < LOCK_PROFILE_LOCKS); i++) {
+    if (merged.entries[i].lock == lock) {
+      *stats = merged.entries[i].stats;
+      found = true;
+    }
+  }
+  return found;
+}
+
+static void print_stats(FILE *stream, const lock_profile_stats_t *stats) {
+  const double acquisitions =
+      (0 < stats->acquisitions) ? (double)stats->acquisitions : 1.0;
+
+  fprintf(stream,
+          "  acquisitions %llu, trylock failures %llu (%.2f%%)\n"
+          "  wait total %.3f ms, mean %.0f ns, max %llu ns\n"
+          "  hold total %.3f ms, mean %.0f ns, max %llu ns\n"
+          "  %14s %12s %12s\n",
+          (unsigned long long)stats->acquisitions,
+          (unsigned long long)stats->trylock_failures,
+          100.0 * (double)stats->trylock_failures / acquisitions,
+          (double)stats->wait_ns / 1e6, (double)stats->wait_ns / acquisitions,
+          (unsigned long long)stats->max_wait_ns,
+          (double)stats->hold_ns / 1e6, (double)stats->hold_ns / acquisitions,
+          (unsigned long long)stats->max_hold_ns, "ns from", "waits",
+          "holds");
+  for (unsigned int b = 0; b < LOCK_PROFILE_BUCKETS; b++)
+    if ((0 < stats->wait_histogram[b]) || (0 < stats->hold_histogram[b]))
+      fprintf(stream, "  %14llu %12llu %12llu\n",
+              (0 == b) ? 0ULL : 1ULL << b,
+              (unsigned long long)stats->wait_histogram[b],
+              (unsigned long long)stats->hold_histogram[b]);
+}
+
+void lock_profile_report(FILE *stream) {
+  struct lock_profile_table merged;
+  bool empty = true;
+
+  pthread_mutex_lock(&lock_profile.mutex);
+  collect(&merged);
+  pthread_mutex_unlock(&lock_profile.mutex);
+
+  fprintf(stream, "Lock contention profile\n");
+  for (unsigned int i = 0;
+       (i < LOCK_PROFILE_LOCKS) && (NULL != merged.entries[i].lock); i++) {
+    fprintf(stream, " lock %p\n", merged.entries[i].lock);
+    print_stats(stream, &merged.entries[i].stats);
+    empty = false;
+  }
+  if (0 < merged.other.stats.acquisitions) {
+    fprintf(stream, " other locks\n");
+    print_stats(stream, &merged.other.stats);
+    empty = false;
+  }
+  if (empty)
+    fprintf(stream, " no lock was taken\n");
+}
+
+void lock_profile_reset(void) {
+  pthread_mutex_lock(&lock_profile.mutex);
+  memset(&lock_profile.retired, 0, sizeof(lock_profile.retired));
+  for (struct lock_profile_thread *thread = lock_profile.threads;
+       NULL != thread; thread = thread->next)
+    memset(&thread->table, 0, sizeof(thread->table));
+  pthread_mutex_unlock(&lock_profile.mutex);
+}
\ No newline at end of file
@@ -0,0 +1,261 @@
+/*******************************************************************************
+ * Copyright (C) 2023 by Salvador Z                                            *
+ *                                                                             *
+ * This file is part of ELSU                                                   *
+ *                                                                             *
+ *   Permission is hereby granted, free of charge, to any person obtaining a   *
+ *   copy of this software and associated documentation files (the Software)   *
+ *   to deal in the Software without restriction including without limitation  *
+ *   the rights to use, copy, modify, merge, publish, distribute, sublicense,  *
+ *   and/or sell copies ot the Software, and to permit persons to whom the     *
+ *   Software is furnished to do so, subject to the following conditions:      *
+ *                                                                             *
+ *   The above copyright notice and this permission notice shall be included   *
+ *   in all copies or substantial portions of the Software.                    *
+ *                                                                             *
+ *   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS   *
+ *   OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARANTIES OF MERCHANTABILITY *
+ *   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL   *
+ *   THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR      *
+ *   OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,     *
+ *   ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE        *
+ *   OR OTHER DEALINGS IN THE SOFTWARE.                                        *
+ ******************************************************************************/
+
+
+/**
+ * @file ticket_lock.c
+ * @author Salvador Z
+ * @date 17 Oct 2026
+ * @brief File for an adaptive spin then park ticket lock
+ *
+ * Every waiter takes a ticket and its turn comes in ticket order, so it
+ * stays fair however contended it is. A waiter first spins with the pause
+ * instruction: a withdrawl holds the lock for a few instructions, far less
+ * than the context switch of going to sleep. The spin budget adapts like
+ * the one of PTHREAD_MUTEX_ADAPTIVE_NP, following how many spins were
+ * recently enough. With more tickets ahead than CPUs the thread can use,
+ * some of them are preempted and spinning would keep them off the CPU, so
+ * the waiter parks after a short fixed spin instead. A parked waiter
+ * sleeps on the futex of the ticket being served, in the bitset of its own
+ * ticket, so an unlock only wakes the waiter whose turn comes (and those 32
+ * tickets away) instead of every sleeper.
+ *
+ * Handing the lock to a sleeper costs a wakeup and a context switch, paid
+ * on every unlock once the threads outnumber the CPUs. So the lock itself
+ * is a separate word, taken with a compare and swap: the waiter whose turn
+ * came claims it, and until it does a running thread may take the lock
+ * without a ticket (barging) instead of queueing behind a sleeper. Once
+ * claimed nobody else barges in, so the turn waits at most for the
+ * critical section already running.
+ *
+ * @see https://man7.org/linux/man-pages/man2/futex.2.html
+ */
+
+#define _GNU_SOURCE /*sched_getaffinity, CPU_COUNT*/
+#include "threads_ticket_lock.h"
+
+#include <limits.h>       /*INT_MAX, UINT_MAX*/
+#include <linux/futex.h>  /*FUTEX_WAIT_BITSET*/
+#include <pthread.h>      /*pthread_once*/
+#include <sched.h>        /*sched_getaffinity, CPU_COUNT*/
+#include <stdio.h>        /*fopen, fscanf*/
+#include <sys/syscall.h>  /*SYS_futex*/
+#include <unistd.h>       /*syscall*/
+
+/* Bounds of the adaptive spin budget */
+#define TICKET_SPINS_MIN 16U
+#define TICKET_SPINS_MAX 4096U
+/* Spin before parking when there are more tickets ahead than CPUs */
+#define TICKET_SPINS_OVERSUBSCRIBED 16U
+
+/* Values of held */
+#define TICKET_FREE 0U
+#define TICKET_OWNED 1U  /* by the waiter whose turn came */
+#define TICKET_BARGED 2U /* by a thread without a ticket */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ticket_cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define ticket_cpu_relax() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define ticket_cpu_relax() ((void)0)
+#endif
+
+static inline uint32_t ticket_bit(uint32_t ticket) {
+  return 1U << (ticket % 32U);
+}
+
+static unsigned int ticket_quota_cpus = UINT_MAX;
+static pthread_once_t ticket_quota_once = PTHREAD_ONCE_INIT;
+static __thread unsigned int ticket_affinity_cpus;
+
+/**
+ * CPUs the cgroup quota of the process allows, rounded up (cgroup v2, then
+ * v1), UINT_MAX without a quota
+ */
+static void ticket_read_quota(void) {
+  long long quota = -1, period = 0;
+  FILE *file = fopen("/sys/fs/cgroup/cpu.max", "r");
+
+  if (NULL != file) {
+    if (2 != fscanf(file, "%lld %lld", &quota, &period))
+      quota = -1; /* "max": no quota */
+    fclose(file);
+  } else if (NULL != (file = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us",
+                                   "r"))) {
+    if (1 != fscanf(file, "%lld", &quota))
+      quota = -1;
+    fclose(file);
+    if ((NULL != (file = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us",
+                               "r")))) {
+      if (1 != fscanf(file, "%lld", &period))
+        quota = -1;
+      fclose(file);
+    }
+  }
+  if ((0 < quota) && (0 < period))
+    ticket_quota_cpus = (unsigned int)((quota + period - 1) / period);
+}
+
+/**
+ * @return uint32_t CPUs the calling thread can run on: its affinity mask
+ * (read once per thread) bounded by the cgroup quota
+ */
+static uint32_t ticket_cpus(void) {
+  if (0 == ticket_affinity_cpus) {
+    cpu_set_t set;
+    ticket_affinity_cpus =
+        (0 == sched_getaffinity(0, sizeof(set), &set)) ? CPU_COUNT(&set) : 1;
+    if (0 == ticket_affinity_cpus)
+      ticket_affinity_cpus = 1;
+  }
+  pthread_once(&ticket_quota_once, ticket_read_quota);
+  return (ticket_quota_cpus < ticket_affinity_cpus) ? ticket_quota_cpus
+                                                    : ticket_affinity_cpus;
+}
+
+/**
+ * Takes the lock without a ticket, when it's free and no turn claims it
+ */
+static inline bool ticket_barge(ticket_lock_t *lock) {
+  uint32_t free = TICKET_FREE;
+
+  return (0 == atomic_load_explicit(&lock->claim, memory_order_relaxed)) &&
+         (TICKET_FREE ==
+          atomic_load_explicit(&lock->held, memory_order_relaxed)) &&
+         atomic_compare_exchange_strong_explicit(&lock->held, &free,
+                                                 TICKET_BARGED,
+                                                 memory_order_acquire,
+                                                 memory_order_relaxed);
+}
+
+/**
+ * The turn of the caller came: takes the lock, waiting (spinning, then
+ * parked) for the thread that barged in, if any
+ */
+static void ticket_hold(ticket_lock_t *lock, uint32_t budget) {
+  uint32_t current = TICKET_FREE;
+  uint32_t spins = 0;
+
+  /* Seen by the threads about to barge in, they queue instead */
+  atomic_store_explicit(&lock->claim, 1U, memory_order_seq_cst);
+  while (!atomic_compare_exchange_weak_explicit(
+      &lock->held, &current, TICKET_OWNED, memory_order_acquire,
+      memory_order_relaxed)) {
+    if (TICKET_FREE == current) {
+      continue; /* spurious failure */
+    } else if (++spins <= budget) {
+      ticket_cpu_relax();
+    } else {
+      /* The unlock checks held_waiters after freeing held, and the futex
+         checks held after publishing held_waiters */
+      atomic_fetch_add_explicit(&lock->held_waiters, 1U, memory_order_seq_cst);
+      syscall(SYS_futex, &lock->held, FUTEX_WAIT_PRIVATE, current, NULL, NULL,
+              0);
+      atomic_fetch_sub_explicit(&lock->held_waiters, 1U, memory_order_relaxed);
+    }
+    current = TICKET_FREE;
+  }
+  atomic_store_explicit(&lock->claim, 0U, memory_order_relaxed);
+}
+
+void ticket_lock_init(ticket_lock_t *lock) {
+  atomic_init(&lock->held, TICKET_FREE);
+  atomic_init(&lock->claim, 0);
+  atomic_init(&lock->held_waiters, 0);
+  atomic_init(&lock->next, 0);
+  atomic_init(&lock->serving, 0);
+  atomic_init(&lock->parked, 0);
+  atomic_init(&lock->spins, TICKET_SPINS_MIN);
+}
+
+void ticket_lock(ticket_lock_t *lock) {
+  uint32_t ticket, serving, spins, budget;
+  bool oversubscribed;
+
+  if (ticket_barge(lock))
+    return;
+
+  ticket = atomic_fetch_add_explicit(&lock->next, 1U, memory_order_relaxed);
+  serving = atomic_load_explicit(&lock->serving, memory_order_acquire);
+  /* The owner and the waiters ahead can't all be running */
+  oversubscribed = (ticket - serving) >= ticket_cpus();
+  if (oversubscribed) {
+    budget = TICKET_SPINS_OVERSUBSCRIBED;
+  } else {
+    /* Twice what recently was enough, within bounds */
+    budget = 2U * atomic_load_explicit(&lock->spins, memory_order_relaxed);
+    budget = (TICKET_SPINS_MIN > budget) ? TICKET_SPINS_MIN : budget;
+    budget = (TICKET_SPINS_MAX < budget) ? TICKET_SPINS_MAX : budget;
+  }
+  if (ticket == serving) {
+    ticket_hold(lock, budget);
+    return;
+  }
+
+  for (spins = 1; (ticket != serving) && (spins <= budget); spins++) {
+    ticket_cpu_relax();
+    serving = atomic_load_explicit(&lock->serving, memory_order_acquire);
+  }
+  if (!oversubscribed) {
+    uint32_t average = atomic_load_explicit(&lock->spins, memory_order_relaxed);
+    atomic_store_explicit(&lock->spins,
+                          average + (uint32_t)((int32_t)(spins - average) / 8),
+                          memory_order_relaxed);
+  }
+
+  if (ticket != serving) {
+    /* Park: the unlock checks parked after publishing serving, and we
+       check serving after publishing parked, so one of both sees the
+       other */
+    atomic_fetch_add_explicit(&lock->parked, 1U, memory_order_seq_cst);
+    while (ticket !=
+           (serving = atomic_load_explicit(&lock->serving,
+                                           memory_order_seq_cst)))
+      syscall(SYS_futex, &lock->serving, FUTEX_WAIT_BITSET_PRIVATE, serving,
+              NULL, NULL, ticket_bit(ticket));
+    atomic_fetch_sub_explicit(&lock->parked, 1U, memory_order_relaxed);
+  }
+  ticket_hold(lock, budget);
+}
+
+bool ticket_trylock(ticket_lock_t *lock) { return ticket_barge(lock); }
+
+void ticket_unlock(ticket_lock_t *lock) {
+  const uint32_t held =
+      atomic_exchange_explicit(&lock->held, TICKET_FREE, memory_order_seq_cst);
+
+  if (0 < atomic_load_explicit(&lock->held_waiters, memory_order_seq_cst))
+    syscall(SYS_futex, &lock->held, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  if (TICKET_OWNED != held)
+    return; /* barged in, the turn is still the one it was */
+
+  /* The turn passes to the next ticket */
+  const uint32_t ticket =
+      atomic_load_explicit(&lock->serving, memory_order_relaxed) + 1U;
+  atomic_store_explicit(&lock->serving, ticket, memory_order_seq_cst);
+  if (0 < atomic_load_explicit(&lock->parked, memory_order_seq_cst))
+    syscall(SYS_futex, &lock->serving, FUTEX_WAKE_BITSET_PRIVATE, INT_MAX,
+            NULL, NULL, ticket_bit(ticket));
+}
\ No newline at end of file
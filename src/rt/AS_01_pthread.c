@@ -4,8 +4,9 @@
 #include <string.h>
 #include <syslog.h> /* system logs*/
 
+#include "processes.h"
+
 #define NUM_THREADS   1
-#define CMD_BUFF_SIZE 1024
 
 void *thread_function(void *arg) {
   (void)arg;
@@ -16,35 +17,34 @@ void *thread_function(void *arg) {
 }
 
 int print_command(char* cmd) {
-  char commandOutput[CMD_BUFF_SIZE];
+  char *arg_list[] = {"sh", "-c", cmd, NULL};
+  process_sink_t output = {-1, NULL, 0};
+  process_result_t result;
 
   if (!cmd)
     return EXIT_FAILURE;
 
-  FILE *commandStream = popen(cmd, "r");
-  if (commandStream == NULL) {
+  // Ejecutar el comando capturando su salida, stderr sigue en la terminal
+  if (0 != process_spawn_capture("/bin/sh", arg_list, &output, NULL,
+                                 &result)) {
     fprintf(stderr, "Error executing command\n");
-    return EXIT_FAILURE;
-  }
-
-  // Leer la salida del comando y almacenarla en commandOutput
-  if (fgets(commandOutput, sizeof(commandOutput), commandStream) == NULL) {
-    fprintf(stderr, "Error reading command output\n");
+    free(output.buffer);
     return EXIT_FAILURE;
   }
 
   // Eliminar el salto de línea final si está presente
-  char *newline = strchr(commandOutput, '\n');
-  if (newline != NULL) {
-    *newline = '\0';
-  }
-
-  // Imprimir la salida almacenada en commandOutput
-  printf("$%s %s\n",cmd, commandOutput);
+  if ((0 < output.length) && ('\n' == output.buffer[output.length - 1]))
+    output.buffer[--output.length] = '\0';
 
-  // Cerrar el flujo de datos
-  pclose(commandStream);
+  // Imprimir la salida capturada
+  printf("$%s %s\n",cmd, (NULL != output.buffer) ? output.buffer : "");
+  free(output.buffer);
 
+  // El comando falló o fue terminado por una señal
+  if ((0 != result.exit_code) || (0 != result.term_signal)) {
+    fprintf(stderr, "Command exited with status %d\n", result.exit_code);
+    return EXIT_FAILURE;
+  }
   return EXIT_SUCCESS;
 }
 